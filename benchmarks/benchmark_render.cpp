@@ -0,0 +1,130 @@
+// Times io::renderAudio at full quality, with each of the draft render's
+// quality reductions on its own, and with all of them, and reports how many
+// times faster than full quality each runs.
+//
+// Usage: benchmark_render [seconds of audio per render]
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// NanoGUI provides the implementation in the canvas executable.
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "io.hpp"
+
+constexpr float k_sampleRate = 48000;
+constexpr float k_overallGain = 0.1;
+constexpr char k_outputFile[] = "benchmark_render.wav";
+
+// Soft strokes over the whole canvas, which leave many faint pixels, like a
+// painting made with the fuzzy brush.
+std::vector<uint32_t> makeImage(int height)
+{
+    std::vector<uint32_t> pixels(k_imageWidth * height, 0);
+    std::mt19937 randomEngine(0);
+    std::uniform_real_distribution<float> distribution;
+    for (int stroke = 0; stroke < 40; stroke++) {
+        float centerY = distribution(randomEngine) * height;
+        float slope = (distribution(randomEngine) - 0.5f) * height / k_imageWidth;
+        float radius = 2 + distribution(randomEngine) * 10;
+        float blueWeight = distribution(randomEngine);
+        for (int x = 0; x < k_imageWidth; x++) {
+            float strokeY = centerY + slope * x;
+            for (int y = 0; y < height; y++) {
+                float distance = std::abs(y - strokeY) / radius;
+                float intensity = std::exp(-distance * distance);
+                uint32_t& pixel = pixels[y * k_imageWidth + x];
+                int blue = std::min(255, getBlue(pixel) + static_cast<int>(255 * intensity * blueWeight));
+                int red = std::min(255, getRed(pixel) + static_cast<int>(255 * intensity * (1 - blueWeight)));
+                pixel = 0xff000000 | (red << 16) | blue;
+            }
+        }
+    }
+    return pixels;
+}
+
+double timeRender(
+    std::vector<uint32_t> pixels,
+    const Tuning& tuning,
+    float secondsToRender,
+    float pdDistort,
+    const io::RenderQuality& quality
+)
+{
+    Image image(pixels.data(), k_imageWidth, tuning.size());
+    std::mt19937 randomEngine(0);
+    io::RenderSettings settings;
+    settings.sampleRate = k_sampleRate;
+    settings.overallGain = k_overallGain;
+    settings.speedInPixelsPerSecond = k_imageWidth / secondsToRender;
+    settings.pdDistort = pdDistort;
+    settings.quality = quality;
+    auto start = std::chrono::steady_clock::now();
+    auto status = io::renderAudio(image, tuning, k_outputFile, randomEngine, settings);
+    auto end = std::chrono::steady_clock::now();
+    if (!std::get<0>(status)) {
+        std::cerr << std::get<1>(status) << std::endl;
+        exit(1);
+    }
+    return std::chrono::duration<double>(end - start).count();
+}
+
+int main(int argc, char** argv)
+{
+    float secondsToRender = argc > 1 ? std::atof(argv[1]) : 60;
+
+    Tuning tuning = tuning::defaultTuning();
+    std::vector<uint32_t> pixels = makeImage(tuning.size());
+
+    io::RenderQuality full;
+    io::RenderQuality draft = io::getDraftQuality();
+    std::vector<std::pair<std::string, io::RenderQuality>> qualities;
+    qualities.push_back({ "full", full });
+    io::RenderQuality quality = full;
+    quality.sampleRateDivisor = draft.sampleRateDivisor;
+    qualities.push_back({ "sample rate", quality });
+    quality = full;
+    quality.maxPartials = draft.maxPartials;
+    qualities.push_back({ "max partials", quality });
+    quality = full;
+    quality.controlBlockSize = draft.controlBlockSize;
+    qualities.push_back({ "control rate", quality });
+    quality = full;
+    quality.phaseDistortion = draft.phaseDistortion;
+    qualities.push_back({ "no pd", quality });
+    qualities.push_back({ "draft", draft });
+
+    for (float pdDistort : { 0.0f, 0.5f }) {
+        std::cout
+            << "pd-distort " << pdDistort << std::endl
+            << std::left << std::setw(16) << "quality"
+            << std::setw(12) << "seconds"
+            << "speedup" << std::endl;
+        double fullSeconds = 0;
+        for (auto& entry : qualities) {
+            double seconds = timeRender(
+                pixels, tuning, secondsToRender, pdDistort, entry.second
+            );
+            if (entry.first == "full") {
+                fullSeconds = seconds;
+            }
+            std::cout
+                << std::left << std::setw(16) << entry.first
+                << std::setw(12) << std::fixed << std::setprecision(3) << seconds
+                << std::setprecision(1) << fullSeconds / seconds << "x"
+                << std::defaultfloat << std::endl;
+        }
+        std::cout << std::endl;
+    }
+
+    std::remove(k_outputFile);
+    return 0;
+}
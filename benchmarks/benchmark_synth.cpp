@@ -0,0 +1,262 @@
+// Times Synth::process with every partial lit and reports how many times
+// faster than realtime each configuration runs, including canvases with
+// thousands of rows and multithreaded rendering.
+//
+// Usage: benchmark_synth [seconds of audio per configuration]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Synth.hpp"
+
+constexpr float k_sampleRate = 48000;
+constexpr int k_blockSize = 256;
+
+struct Result {
+    double secondsElapsed;
+    double secondsRendered;
+};
+
+struct Configuration {
+    float sampleRate = k_sampleRate;
+    SynthEngine engine = SynthEngine::Oscillators;
+    PhaseMode phaseMode = PhaseMode::Float;
+    int pdMode = 0;
+    float pdDistort = 0;
+    // Number of lit rows, spread evenly over the canvas. -1 lights all.
+    int numLit = -1;
+    Tuning tuning = tuning::defaultTuning();
+    int numThreads = 1;
+    bool rotation = true;
+    bool multirate = true;
+};
+
+Result runBenchmark(const Configuration& configuration, float secondsToRender)
+{
+    std::mt19937 randomEngine(0);
+    Synth synth(configuration.sampleRate, configuration.tuning, randomEngine);
+    synth.setEngine(configuration.engine);
+    synth.setNumThreads(configuration.numThreads);
+    synth.setRotationEnabled(configuration.rotation);
+    synth.setMultirateEnabled(configuration.multirate);
+    synth.setPhaseMode(configuration.phaseMode);
+    synth.setPDMode(configuration.pdMode);
+    synth.setPDDistort(configuration.pdDistort);
+    synth.waitForWavetables();
+
+    int numOscillators = synth.getNumOscillators();
+    int numLit = configuration.numLit < 0 ? numOscillators : configuration.numLit;
+    std::uniform_real_distribution<float> distribution(0, 0.01);
+    for (int i = 0; i < numLit; i++) {
+        synth.setOscillatorAmplitude(
+            i * numOscillators / numLit,
+            distribution(randomEngine),
+            distribution(randomEngine)
+        );
+    }
+
+    float left[k_blockSize];
+    float right[k_blockSize];
+    float* outputBuffer[2] = { left, right };
+
+    int numBlocks = secondsToRender * configuration.sampleRate / k_blockSize;
+    // Warm up caches and the branch predictor.
+    for (int i = 0; i < numBlocks / 10; i++) {
+        synth.process(2, outputBuffer, k_blockSize);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    float checksum = 0;
+    for (int i = 0; i < numBlocks; i++) {
+        synth.process(2, outputBuffer, k_blockSize);
+        checksum += left[0] + right[0];
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    // Keep the optimizer from discarding the work.
+    if (checksum == 12345.f) {
+        std::cout << "";
+    }
+
+    Result result;
+    result.secondsElapsed = std::chrono::duration<double>(end - start).count();
+    result.secondsRendered = (
+        static_cast<double>(numBlocks) * k_blockSize / configuration.sampleRate
+    );
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    float secondsToRender = argc > 1 ? std::atof(argv[1]) : 10;
+
+    std::vector<std::string> pdModeNames = { "pulsar", "saw", "square", "sine_pwm" };
+    std::vector<float> pdDistorts = { 0, 0.5 };
+
+    std::cout
+        << std::left << std::setw(10) << "pd-mode"
+        << std::setw(12) << "pd-distort"
+        << std::setw(16) << "float (x rt)"
+        << std::setw(16) << "fixed (x rt)"
+        << "speedup" << std::endl;
+
+    for (int pdMode = 0; pdMode < static_cast<int>(pdModeNames.size()); pdMode++) {
+        for (float pdDistort : pdDistorts) {
+            Configuration configuration;
+            configuration.pdMode = pdMode;
+            configuration.pdDistort = pdDistort;
+            // Phase modes only differ in the table path; rotation would take
+            // over undistorted partials.
+            configuration.rotation = false;
+            auto floatResult = runBenchmark(configuration, secondsToRender);
+            configuration.phaseMode = PhaseMode::FixedPoint;
+            auto fixedResult = runBenchmark(configuration, secondsToRender);
+            double floatRealtime = floatResult.secondsRendered / floatResult.secondsElapsed;
+            double fixedRealtime = fixedResult.secondsRendered / fixedResult.secondsElapsed;
+            std::cout
+                << std::left << std::setw(10) << pdModeNames[pdMode]
+                << std::setw(12) << pdDistort
+                << std::setw(16) << std::fixed << std::setprecision(1) << floatRealtime
+                << std::setw(16) << fixedRealtime
+                << std::setprecision(2) << fixedRealtime / floatRealtime << "x"
+                << std::defaultfloat << std::endl;
+        }
+    }
+
+    std::cout
+        << std::endl
+        << std::left << std::setw(10) << "phase"
+        << std::setw(16) << "table (x rt)"
+        << std::setw(16) << "rotation (x rt)"
+        << "speedup" << std::endl;
+
+    for (PhaseMode phaseMode : { PhaseMode::Float, PhaseMode::FixedPoint }) {
+        Configuration configuration;
+        configuration.phaseMode = phaseMode;
+        configuration.multirate = false;
+        configuration.rotation = false;
+        auto tableResult = runBenchmark(configuration, secondsToRender);
+        configuration.rotation = true;
+        auto rotationResult = runBenchmark(configuration, secondsToRender);
+        double tableRealtime = tableResult.secondsRendered / tableResult.secondsElapsed;
+        double rotationRealtime = (
+            rotationResult.secondsRendered / rotationResult.secondsElapsed
+        );
+        std::cout
+            << std::left << std::setw(10)
+            << (phaseMode == PhaseMode::Float ? "float" : "fixed")
+            << std::setw(16) << std::fixed << std::setprecision(1) << tableRealtime
+            << std::setw(16) << rotationRealtime
+            << std::setprecision(2) << rotationRealtime / tableRealtime << "x"
+            << std::defaultfloat << std::endl;
+    }
+
+    std::cout
+        << std::endl
+        << std::left << std::setw(10) << "rate"
+        << std::setw(22) << "single rate (x rt)"
+        << std::setw(16) << "multirate (x rt)"
+        << "speedup" << std::endl;
+
+    for (float sampleRate : { 48000, 96000, 192000 }) {
+        Configuration configuration;
+        configuration.sampleRate = sampleRate;
+        configuration.multirate = false;
+        auto singleResult = runBenchmark(configuration, secondsToRender);
+        configuration.multirate = true;
+        auto multirateResult = runBenchmark(configuration, secondsToRender);
+        double singleRealtime = singleResult.secondsRendered / singleResult.secondsElapsed;
+        double multirateRealtime = (
+            multirateResult.secondsRendered / multirateResult.secondsElapsed
+        );
+        std::cout
+            << std::left << std::setw(10) << sampleRate
+            << std::setw(22) << std::fixed << std::setprecision(1) << singleRealtime
+            << std::setw(16) << multirateRealtime
+            << std::setprecision(2) << multirateRealtime / singleRealtime << "x"
+            << std::defaultfloat << std::endl;
+    }
+
+    std::cout
+        << std::endl
+        << std::left << std::setw(10) << "lit rows"
+        << std::setw(22) << "oscillators (x rt)"
+        << std::setw(16) << "ifft (x rt)"
+        << "speedup" << std::endl;
+
+    for (int numLit : { 8, 32, 128, -1 }) {
+        Configuration configuration;
+        configuration.numLit = numLit;
+        auto oscillatorResult = runBenchmark(configuration, secondsToRender);
+        configuration.engine = SynthEngine::InverseFFT;
+        auto inverseFFTResult = runBenchmark(configuration, secondsToRender);
+        double oscillatorRealtime = (
+            oscillatorResult.secondsRendered / oscillatorResult.secondsElapsed
+        );
+        double inverseFFTRealtime = (
+            inverseFFTResult.secondsRendered / inverseFFTResult.secondsElapsed
+        );
+        std::cout
+            << std::left << std::setw(10)
+            << (numLit < 0 ? std::string("all") : std::to_string(numLit))
+            << std::setw(22) << std::fixed << std::setprecision(1) << oscillatorRealtime
+            << std::setw(16) << inverseFFTRealtime
+            << std::setprecision(2) << inverseFFTRealtime / oscillatorRealtime << "x"
+            << std::defaultfloat << std::endl;
+    }
+
+    std::cout
+        << std::endl
+        << std::left << std::setw(10) << "rows"
+        << std::setw(22) << "oscillators (x rt)"
+        << std::setw(16) << "auto (x rt)" << std::endl;
+
+    for (int numRows : { 500, 1000, 2000, 4000 }) {
+        Configuration configuration;
+        configuration.tuning = tuning::logRange(numRows, 20, 20000);
+        auto oscillatorResult = runBenchmark(configuration, secondsToRender);
+        configuration.engine = SynthEngine::Auto;
+        auto autoResult = runBenchmark(configuration, secondsToRender);
+        std::cout
+            << std::left << std::setw(10) << numRows
+            << std::setw(22) << std::fixed << std::setprecision(1)
+            << oscillatorResult.secondsRendered / oscillatorResult.secondsElapsed
+            << std::setw(16) << autoResult.secondsRendered / autoResult.secondsElapsed
+            << std::defaultfloat << std::endl;
+    }
+
+    std::cout
+        << std::endl
+        << std::left << std::setw(10) << "threads"
+        << std::setw(16) << "1000 rows (x rt)"
+        << "speedup" << std::endl;
+
+    Configuration singleThreaded;
+    singleThreaded.tuning = tuning::logRange(1000, 20, 20000);
+    auto singleResult = runBenchmark(singleThreaded, secondsToRender);
+    double singleRealtime = singleResult.secondsRendered / singleResult.secondsElapsed;
+    int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (int numThreads = 1; numThreads <= maxThreads; numThreads *= 2) {
+        double realtime = singleRealtime;
+        if (numThreads > 1) {
+            Configuration configuration = singleThreaded;
+            configuration.numThreads = numThreads;
+            auto result = runBenchmark(configuration, secondsToRender);
+            realtime = result.secondsRendered / result.secondsElapsed;
+        }
+        std::cout
+            << std::left << std::setw(10) << numThreads
+            << std::setw(16) << std::fixed << std::setprecision(1) << realtime
+            << std::setprecision(2) << realtime / singleRealtime << "x"
+            << std::defaultfloat << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <utility>
+#ifdef _WIN32
+#include <malloc.h>
+#endif // _WIN32
+
+// Alignment of SIMD-friendly arrays. 64 bytes covers an AVX-512 register and a
+// cache line, so loads never straddle two lines.
+constexpr std::size_t k_simdAlignment = 64;
+
+// Fixed-size, zero-initialized heap array whose storage starts on a
+// k_simdAlignment boundary. Only meant for trivial types such as float.
+template <class T>
+class AlignedBuffer {
+public:
+    AlignedBuffer() { }
+    AlignedBuffer(int size) { resize(size); }
+    ~AlignedBuffer() { release(); }
+
+    AlignedBuffer(const AlignedBuffer&) = delete;
+    AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+    AlignedBuffer(AlignedBuffer&& other)
+        : m_data(other.m_data), m_size(other.m_size)
+    {
+        other.m_data = nullptr;
+        other.m_size = 0;
+    }
+
+    AlignedBuffer& operator=(AlignedBuffer&& other)
+    {
+        std::swap(m_data, other.m_data);
+        std::swap(m_size, other.m_size);
+        return *this;
+    }
+
+    // Discards the current contents.
+    void resize(int size);
+
+    T* data() { return m_data; };
+    const T* data() const { return m_data; };
+    int size() const { return m_size; };
+
+    T& operator[](int index) { return m_data[index]; };
+    const T& operator[](int index) const { return m_data[index]; };
+
+private:
+    T* m_data = nullptr;
+    int m_size = 0;
+
+    void release();
+};
+
+template <class T>
+void AlignedBuffer<T>::resize(int size)
+{
+    release();
+    if (size <= 0) {
+        return;
+    }
+    std::size_t bytes = sizeof(T) * size;
+    // Round up so aligned_alloc-style allocators accept the request.
+    bytes = (bytes + k_simdAlignment - 1) / k_simdAlignment * k_simdAlignment;
+    void* memory = nullptr;
+#ifdef _WIN32
+    memory = _aligned_malloc(bytes, k_simdAlignment);
+#else
+    if (posix_memalign(&memory, k_simdAlignment, bytes) != 0) {
+        memory = nullptr;
+    }
+#endif // _WIN32
+    if (memory == nullptr) {
+        throw std::bad_alloc();
+    }
+    m_data = static_cast<T*>(memory);
+    m_size = size;
+    for (int i = 0; i < m_size; i++) {
+        m_data[i] = T();
+    }
+}
+
+template <class T>
+void AlignedBuffer<T>::release()
+{
+    if (m_data == nullptr) {
+        return;
+    }
+#ifdef _WIN32
+    _aligned_free(m_data);
+#else
+    free(m_data);
+#endif // _WIN32
+    m_data = nullptr;
+    m_size = 0;
+}
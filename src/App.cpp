@@ -1,30 +1,49 @@
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
 #include "App.hpp"
 
 #include "io.hpp"
 
+// The ring buffer has room for a few messages to the audio thread, plus
+// those that wait while rendering ahead. A block of render-ahead latency is
+// shorter than a GUI frame, so one more message per block is plenty.
+static int getRingBufferSize(int numRows, int renderAheadBlocks)
+{
+    return nextPowerOfTwo((4 + renderAheadBlocks) * message::getSize(numRows));
+}
+
+// Threads for realtime synthesis. Half the hardware threads, so hyperthreads
+// and the GUI don't compete with the audio, and no more than a handful, past
+// which waking workers eats the gain.
+constexpr int k_maxAudioThreads = 8;
+
+static int getNumAudioThreads()
+{
+    int numThreads = std::thread::hardware_concurrency() / 2;
+    return std::max(1, std::min(numThreads, k_maxAudioThreads));
+}
 
-App::App()
+App::App(const Tuning& tuning, std::string tuningDescription)
     : m_ringBuffer(
-        std::make_shared<RingBuffer<float>>(
-            nextPowerOfTwo(2 + k_windowHeight * 2)
-        )
+        std::make_shared<RingBuffer<float>>(getRingBufferSize(tuning.size(), 0))
     )
+    , m_imageHeight(tuning.size())
+    , m_tuning(tuning)
+    , m_tuningDescription(tuningDescription)
+    , m_amplitudeMessage(message::getSize(tuning.size()))
     , m_randomEngine(m_randomDevice())
+    , m_renderSeed(m_randomDevice())
 {
     initSDL();
     initWindow();
     initRenderer();
     initGUI();
+    createTexture();
 
-    m_texture = SDL_CreateTexture(
-        m_renderer,
-        SDL_PIXELFORMAT_ARGB8888,
-        SDL_TEXTUREACCESS_STATIC,
-        k_imageWidth,
-        k_imageHeight
-    );
-
-    m_pixels = new Uint32[k_imageHeight * k_imageWidth];
+    m_pixels = new Uint32[m_imageHeight * k_imageWidth];
+    m_columns = std::make_unique<ColumnMirror>(k_imageWidth, m_imageHeight);
     clear();
 }
 
@@ -37,24 +56,109 @@ void App::initAudio()
 {
     m_audioBackend.run();
 
-    float sampleRate = m_audioBackend.getSampleRate();
-
-    m_synth = std::make_unique<Synth>(sampleRate, m_randomEngine);
+    m_ringBuffer = std::make_shared<RingBuffer<float>>(
+        getRingBufferSize(m_tuning.size(), m_renderAheadBlocks)
+    );
+    createSynth(m_tuning);
     m_audioBackend.setCallback([this](
         int outChannels,
         float** output_buffer,
         int numFrames
     ) {
-        m_synth->processRealtime(
-            outChannels, output_buffer, numFrames, m_ringBuffer
-        );
+        if (m_renderAhead) {
+            m_playedFrames += m_renderAhead->process(outChannels, output_buffer, numFrames);
+        } else {
+            m_synth->processRealtime(
+                outChannels, output_buffer, numFrames, m_ringBuffer
+            );
+            m_playedFrames += numFrames;
+        }
     });
 }
 
+void App::createSynth(const Tuning& tuning)
+{
+    // The worker renders with the old synth until it is gone.
+    m_renderAhead.reset();
+    m_synth = std::make_unique<Synth>(
+        m_audioBackend.getSampleRate(), tuning, m_randomEngine
+    );
+    m_synth->setNumThreads(getNumAudioThreads());
+    m_synth->setCPUBudget(m_cpuBudget);
+    if (m_renderAheadBlocks > 0) {
+        m_renderAhead = std::make_unique<RenderAheadWorker>(
+            *m_synth, m_ringBuffer, m_audioBackend.getBlockSize(), m_renderAheadBlocks
+        );
+    }
+    // Messages are timed by the new synth's output, which starts over.
+    m_playedFrames = 0;
+    m_positionFrame = 0;
+}
+
+void App::createTexture()
+{
+    m_texture = SDL_CreateTexture(
+        m_renderer,
+        SDL_PIXELFORMAT_ARGB8888,
+        SDL_TEXTUREACCESS_STATIC,
+        k_imageWidth,
+        m_imageHeight
+    );
+}
+
+bool App::setTuning(std::string description, int numRows)
+{
+    Tuning tuning;
+    auto status = tuning::parse(description, numRows, tuning);
+    bool success = std::get<0>(status);
+    std::string errorMessage = std::get<1>(status);
+    if (!success) {
+        displayError(errorMessage);
+        return false;
+    }
+
+    int imageHeight = tuning.size();
+    Uint32* pixels = new Uint32[imageHeight * k_imageWidth];
+    filters::clear(Image(pixels, k_imageWidth, imageHeight));
+    for (int y = 0; y < imageHeight; y++) {
+        int oldRow = tuning::findNearestRow(m_tuning, tuning[imageHeight - 1 - y]);
+        if (oldRow == -1) {
+            continue;
+        }
+        int oldY = m_imageHeight - 1 - oldRow;
+        for (int x = 0; x < k_imageWidth; x++) {
+            pixels[y * k_imageWidth + x] = m_pixels[oldY * k_imageWidth + x];
+        }
+    }
+
+    // The audio callback uses the synth and the ring buffer, so replace them
+    // while the stream is stopped.
+    m_audioBackend.pause();
+    m_ringBuffer = std::make_shared<RingBuffer<float>>(
+        getRingBufferSize(imageHeight, m_renderAheadBlocks)
+    );
+    createSynth(tuning);
+    m_audioBackend.resume();
+
+    delete[] m_pixels;
+    m_pixels = pixels;
+    m_imageHeight = imageHeight;
+    m_columns = std::make_unique<ColumnMirror>(k_imageWidth, imageHeight);
+    markAllDirty();
+    m_tuning = tuning;
+    m_tuningDescription = description;
+    m_amplitudeMessage.resize(message::getSize(imageHeight));
+
+    SDL_DestroyTexture(m_texture);
+    createTexture();
+    return true;
+}
+
 void App::run()
 {
     initAudio();
     mainLoop();
+    m_audioBackend.end();
 }
 
 void App::startPlayback()
@@ -75,39 +179,45 @@ void App::displayError(std::string message)
 
 void App::clear()
 {
-    Image image(m_pixels, k_imageWidth, k_imageHeight);
+    Image image(m_pixels, k_imageWidth, m_imageHeight);
     filters::clear(image);
+    markAllDirty();
 }
 
 void App::applyInvert()
 {
-    Image image(m_pixels, k_imageWidth, k_imageHeight);
+    Image image(m_pixels, k_imageWidth, m_imageHeight);
     filters::applyInvert(image);
+    markAllDirty();
 }
 
 void App::applyReverb(float decay, float damping, bool reverse)
 {
-    Image image(m_pixels, k_imageWidth, k_imageHeight);
+    Image image(m_pixels, k_imageWidth, m_imageHeight);
     filters::applyReverb(image, decay, damping, reverse);
+    markAllDirty();
 }
 
 void App::applyChorus(float rate, float depth)
 {
-    Image image(m_pixels, k_imageWidth, k_imageHeight);
+    Image image(m_pixels, k_imageWidth, m_imageHeight);
     filters::applyChorus(image, m_randomEngine, rate, depth);
+    markAllDirty();
 }
 
 
 void App::applyScaleFilter(int root, int scaleClass)
 {
-    Image image(m_pixels, k_imageWidth, k_imageHeight);
-    filters::applyScaleFilter(image, root, scaleClass);
+    Image image(m_pixels, k_imageWidth, m_imageHeight);
+    filters::applyScaleFilter(image, m_tuning, root, scaleClass);
+    markAllDirty();
 }
 
 void App::applyTremolo(float rate, float depth, int shape, float stereo)
 {
-    Image image(m_pixels, k_imageWidth, k_imageHeight);
+    Image image(m_pixels, k_imageWidth, m_imageHeight);
     filters::applyTremolo(image, rate, depth, shape, stereo);
+    markAllDirty();
 }
 
 void App::applyHarmonics(
@@ -118,15 +228,19 @@ void App::applyHarmonics(
     bool subharmonics
 )
 {
-    Image image(m_pixels, k_imageWidth, k_imageHeight);
+    Image image(m_pixels, k_imageWidth, m_imageHeight);
     filters::applyHarmonics(
-        image, amplitude2, amplitude3, amplitude4, amplitude5, subharmonics
+        image, m_tuning, amplitude2, amplitude3, amplitude4, amplitude5, subharmonics
     );
+    markAllDirty();
 }
 
 bool App::loadAudio(std::string fileName) {
-    Image image(m_pixels, k_imageWidth, k_imageHeight);
-    auto status = io::loadAudio(image, fileName);
+    Image image(m_pixels, k_imageWidth, m_imageHeight);
+    // The GUI waits for the analysis, so it takes as many threads as
+    // playback does.
+    auto status = io::loadAudio(image, m_tuning, fileName, getNumAudioThreads());
+    markAllDirty();
     bool success = std::get<0>(status);
     std::string errorMessage = std::get<1>(status);
     if (!success) {
@@ -135,18 +249,22 @@ bool App::loadAudio(std::string fileName) {
     return success;
 }
 
-bool App::renderAudio(std::string fileName) {
-    Image image(m_pixels, k_imageWidth, k_imageHeight);
-    auto status = io::renderAudio(
-        image,
-        fileName,
-        m_randomEngine,
-        m_audioBackend.getSampleRate(),
-        m_overallGain,
-        m_speedInPixelsPerSecond,
-        m_pdMode,
-        m_pdDistort
-    );
+bool App::renderAudio(std::string fileName, bool draft) {
+    Image image(m_pixels, k_imageWidth, m_imageHeight);
+    std::mt19937 renderEngine(m_renderSeed);
+    io::RenderSettings settings;
+    settings.sampleRate = m_audioBackend.getSampleRate();
+    settings.overallGain = m_overallGain;
+    settings.speedInPixelsPerSecond = m_speedInPixelsPerSecond;
+    settings.pdMode = m_pdMode;
+    settings.pdDistort = m_pdDistort;
+    settings.engine = m_engine;
+    settings.stemCacheDirectory = m_stemCacheDirectory;
+    if (draft) {
+        settings.quality = io::getDraftQuality();
+        fileName = io::getDraftFileName(fileName);
+    }
+    auto status = io::renderAudio(image, m_tuning, fileName, renderEngine, settings);
     bool success = std::get<0>(status);
     std::string errorMessage = std::get<1>(status);
     if (!success) {
@@ -156,8 +274,9 @@ bool App::renderAudio(std::string fileName) {
 }
 
 bool App::loadImage(std::string fileName) {
-    Image image(m_pixels, k_imageWidth, k_imageHeight);
+    Image image(m_pixels, k_imageWidth, m_imageHeight);
     auto status = io::loadImage(image, fileName);
+    markAllDirty();
     bool success = std::get<0>(status);
     std::string errorMessage = std::get<1>(status);
     if (!success) {
@@ -167,7 +286,7 @@ bool App::loadImage(std::string fileName) {
 }
 
 bool App::saveImage(std::string fileName) {
-    Image image(m_pixels, k_imageWidth, k_imageHeight);
+    Image image(m_pixels, k_imageWidth, m_imageHeight);
     auto status = io::saveImage(image, fileName);
     bool success = std::get<0>(status);
     std::string errorMessage = std::get<1>(status);
@@ -219,20 +338,28 @@ void App::initGUI()
 
 void App::drawPixel(int x, int y, float red, float green, float blue, float alpha)
 {
-    Image image(m_pixels, k_imageWidth, k_imageHeight);
+    Image image(m_pixels, k_imageWidth, m_imageHeight);
     draw::drawPixel(image, x, y, red, green, blue, alpha);
+    markDirty(x, y, x, y);
 }
 
 void App::drawFuzzyCircle(int x, int y, int radius, float red, float green, float blue, float alpha)
 {
-    Image image(m_pixels, k_imageWidth, k_imageHeight);
+    Image image(m_pixels, k_imageWidth, m_imageHeight);
     draw::drawFuzzyCircle(image, x, y, radius, red, green, blue, alpha);
+    markDirty(x - radius - 1, y - radius - 1, x + radius + 1, y + radius + 1);
 }
 
 void App::drawLine(int x1, int y1, int x2, int y2, int radius, float red, float green, float blue, float alpha)
 {
-    Image image(m_pixels, k_imageWidth, k_imageHeight);
+    Image image(m_pixels, k_imageWidth, m_imageHeight);
     draw::drawLine(image, x1, y1, x2, y2, radius, red, green, blue, alpha);
+    markDirty(
+        std::min(x1, x2) - radius - 1,
+        std::min(y1, y2) - radius - 1,
+        std::max(x1, x2) + radius + 1,
+        std::max(y1, y2) + radius + 1
+    );
 }
 
 void App::spray(
@@ -246,14 +373,57 @@ void App::spray(
     float alpha
 )
 {
-    Image image(m_pixels, k_imageWidth, k_imageHeight);
+    Image image(m_pixels, k_imageWidth, m_imageHeight);
     draw::spray(image, x, y, radius, density, red, green, blue, alpha, m_randomEngine);
+    int margin = static_cast<int>(radius) + 1;
+    markDirty(x - margin, y - margin, x + margin, y + margin);
 }
 
 void App::sprayLine(int x1, int y1, int x2, int y2, int radius, float density, float red, float green, float blue, float alpha)
 {
-    Image image(m_pixels, k_imageWidth, k_imageHeight);
+    Image image(m_pixels, k_imageWidth, m_imageHeight);
     draw::sprayLine(image, x1, y1, x2, y2, radius, density, red, green, blue, alpha, m_randomEngine);
+    markDirty(
+        std::min(x1, x2) - radius - 1,
+        std::min(y1, y2) - radius - 1,
+        std::max(x1, x2) + radius + 1,
+        std::max(y1, y2) + radius + 1
+    );
+}
+
+// Drawing marks a rectangle around what it may have touched, with a pixel of
+// margin for antialiasing and rounding.
+void App::markDirty(int x1, int y1, int x2, int y2)
+{
+    if (m_dirtyX1 > m_dirtyX2) {
+        m_dirtyX1 = x1;
+        m_dirtyY1 = y1;
+        m_dirtyX2 = x2;
+        m_dirtyY2 = y2;
+        return;
+    }
+    m_dirtyX1 = std::min(m_dirtyX1, x1);
+    m_dirtyY1 = std::min(m_dirtyY1, y1);
+    m_dirtyX2 = std::max(m_dirtyX2, x2);
+    m_dirtyY2 = std::max(m_dirtyY2, y2);
+}
+
+void App::markAllDirty()
+{
+    markDirty(0, 0, k_imageWidth - 1, m_imageHeight - 1);
+}
+
+void App::updateColumns()
+{
+    if (m_dirtyX1 > m_dirtyX2) {
+        return;
+    }
+    Image image(m_pixels, k_imageWidth, m_imageHeight);
+    m_columns->update(image, m_dirtyX1, m_dirtyY1, m_dirtyX2, m_dirtyY2);
+    m_dirtyX1 = 0;
+    m_dirtyY1 = 0;
+    m_dirtyX2 = -1;
+    m_dirtyY2 = -1;
 }
 
 void App::handleEventDrawEraseAndSpray(SDL_Event& event)
@@ -283,7 +453,7 @@ void App::handleEventDrawEraseAndSpray(SDL_Event& event)
             );
             int mouseY = (
                 static_cast<float>(event.motion.y)
-                * k_imageHeight / k_windowHeight
+                * m_imageHeight / k_windowHeight
             );
             if (m_mode == App::Mode::Spray) {
                 spray(
@@ -304,7 +474,7 @@ void App::handleEventDrawEraseAndSpray(SDL_Event& event)
             );
             int mouseY = (
                 static_cast<float>(event.motion.y)
-                * k_imageHeight / k_windowHeight
+                * m_imageHeight / k_windowHeight
             );
             if (m_lastMouseX >= 0 && m_lastMouseY >= 0) {
                 if (m_mode == App::Mode::Spray) {
@@ -348,7 +518,7 @@ void App::handleEventHorizontalLine(SDL_Event& event) {
     if (event.button.button == SDL_BUTTON_LEFT) {
         int mouseY = (
             static_cast<float>(event.motion.y)
-            * k_imageHeight / k_windowHeight
+            * m_imageHeight / k_windowHeight
         );
         for (int x = 0; x < k_imageWidth; x++) {
             drawPixel(x, mouseY, m_red, m_green, m_blue, m_opacity);
@@ -357,7 +527,7 @@ void App::handleEventHorizontalLine(SDL_Event& event) {
 }
 
 
-void App::handleEvents()
+bool App::handleEvents()
 {
     SDL_Event event;
     while (SDL_PollEvent(&event)) {
@@ -366,7 +536,7 @@ void App::handleEvents()
             continue;
         }
         if (event.type == SDL_QUIT) {
-            exit(0);
+            return false;
         }
         if (
             m_mode == App::Mode::Draw
@@ -379,14 +549,18 @@ void App::handleEvents()
             handleEventHorizontalLine(event);
         }
     }
+    return true;
 }
 
 void App::mainLoop()
 {
     while (true) {
+        updatePosition();
         sendAmplitudesToAudioThread();
         SDL_UpdateTexture(m_texture, nullptr, m_pixels, k_imageWidth * sizeof(Uint32));
-        handleEvents();
+        if (!handleEvents()) {
+            return;
+        }
 
         SDL_SetRenderDrawBlendMode(m_renderer, SDL_BLENDMODE_BLEND);
         SDL_SetRenderDrawColor(m_renderer, 0, 0, 0, 255);
@@ -415,44 +589,60 @@ void App::mainLoop()
             SDL_RenderFillRect(m_renderer, &fillRect);
         }
 
+        m_gui->setAudioLoad(m_synth->getLoad(), m_synth->getNumCulled());
         m_gui->drawAll();
 
         SDL_RenderPresent(m_renderer);
 
         int delayInMilliseconds = 16;
         SDL_Delay(delayInMilliseconds);
+    }
+}
 
-        if (m_playing) {
-            m_position += m_speedInPixelsPerSecond * delayInMilliseconds / 1000;
-            while (m_position > k_imageWidth) {
-                m_position -= k_imageWidth;
-            }
-        }
+void App::updatePosition()
+{
+    // Follow the audio output rather than the GUI's frame rate, so the
+    // playhead stays with what is heard.
+    int64_t playedFrames = m_playedFrames.load();
+    if (m_playing) {
+        m_position += m_speedInPixelsPerSecond
+            * (playedFrames - m_positionFrame) / m_audioBackend.getSampleRate();
+        m_position = std::fmod(m_position, static_cast<float>(k_imageWidth));
     }
+    m_positionFrame = playedFrames;
 }
 
 void App::sendAmplitudesToAudioThread()
 {
-    int position = m_position;
+    // Time the message for when what is rendered now will be heard, and
+    // play the column the playhead will be at by then.
+    int latency = m_renderAhead ? m_renderAhead->getLatency() : 0;
+    float aheadPosition = m_position
+        + m_speedInPixelsPerSecond * latency / m_audioBackend.getSampleRate();
+    int position = static_cast<int>(aheadPosition) % k_imageWidth;
 
-    constexpr int amplitudeOffset = 2;
-    constexpr int size = amplitudeOffset + 2 * k_imageHeight;
-    float data[size];
+    float* data = m_amplitudeMessage.data();
+    int size = m_amplitudeMessage.size();
 
     data[0] = m_pdMode;
     data[1] = m_pdDistort;
+    data[2] = static_cast<int>(m_engine);
+    message::setTime(data, m_positionFrame + latency);
 
+    float* amplitudes = data + message::k_amplitudeOffset;
     if (!m_playing) {
-        for (int i = 0; i < 2 * k_imageHeight; i++) {
-            data[amplitudeOffset + i] = 0;
+        for (int i = 0; i < 2 * m_imageHeight; i++) {
+            amplitudes[i] = 0;
         }
     } else {
-        for (int i = 0; i < k_imageHeight; i++) {
-            int index = k_imageWidth * (k_imageHeight - 1 - i) + position;
-            data[amplitudeOffset + 2 * i] = (m_pixels[index] & 0x000000ff) / 255.0 * m_overallGain;
-            data[amplitudeOffset + 2 * i + 1] = ((m_pixels[index] & 0x00ff0000) >> 16) / 255.0 * m_overallGain;
+        updateColumns();
+        const float* column = m_columns->getColumn(position);
+        for (int i = 0; i < 2 * m_imageHeight; i++) {
+            amplitudes[i] = column[i] * m_overallGain;
         }
     }
 
-    m_ringBuffer->write(data, 2 + 2 * k_imageHeight);
+    // If the audio thread has fallen behind and the buffer is full, this
+    // message is dropped; the next frame sends a newer one.
+    m_ringBuffer->write(data, size);
 }
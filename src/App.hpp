@@ -1,4 +1,5 @@
 #pragma once
+#include <atomic>
 #include <iostream>
 #include <memory>
 #include <random>
@@ -14,27 +15,30 @@
 
 #include <fftw3.h>
 
+#include "ColumnMirror.hpp"
 #include "common.hpp"
 #include "draw.hpp"
 #include "filters.hpp"
 #include "GUI.hpp"
 #include "Synth.hpp"
 #include "PortAudioBackend.hpp"
+#include "RenderAheadWorker.hpp"
 #include "RingBuffer.hpp"
+#include "Tuning.hpp"
 
 constexpr int k_windowWidth = 2 * 640;
 constexpr int k_windowHeight = 2 * 480;
 
-constexpr int k_imageWidth = 640;
-constexpr int k_imageHeight = 239;
-
 class GUI;
 
 class App {
 public:
-    App();
+    // The canvas has one row per entry of the tuning. The description is
+    // what tuning::parse made it from, shown in the GUI.
+    App(const Tuning& tuning, std::string tuningDescription);
     ~App();
 
+    // Returns when the window is closed, with audio stopped.
     void run();
 
     enum class Mode {
@@ -55,7 +59,10 @@ public:
     void setOpacity(float opacity) { m_opacity = opacity; }
     void setBrushSize(float brushSize) { m_brushSize = brushSize; }
 
-    bool renderAudio(std::string fileName);
+    // A draft render is much faster, for auditioning. See
+    // io::getDraftQuality. It goes to io::getDraftFileName(fileName), so it
+    // never replaces a full-quality render.
+    bool renderAudio(std::string fileName, bool draft);
     bool loadImage(std::string fileName);
     bool saveImage(std::string fileName);
     bool loadAudio(std::string fileName);
@@ -68,6 +75,21 @@ public:
 
     void setPDMode(int pdMode) { m_pdMode = pdMode; };
     void setPDDistort(float pdDistort) { m_pdDistort = pdDistort; };
+    void setEngine(SynthEngine engine) { m_engine = engine; };
+    // See Synth::setCPUBudget. Call before run().
+    void setCPUBudget(float budget) { m_cpuBudget = budget; };
+    // Where renderAudio keeps the audio of each row between renders, or ""
+    // for no stem cache.
+    void setStemCacheDirectory(std::string directory) { m_stemCacheDirectory = directory; };
+    // Blocks of audio to synthesize ahead on a worker thread, or 0 to
+    // synthesize in the audio callback. Call before run().
+    void setRenderAhead(int numBlocks) { m_renderAheadBlocks = numBlocks; };
+
+    std::string getTuningDescription() { return m_tuningDescription; };
+    int getNumRows() { return m_tuning.size(); };
+    // Changes the rows of the canvas and rebuilds the synth. What is drawn
+    // stays at the same pitches where the new tuning has rows close by.
+    bool setTuning(std::string description, int numRows);
 
     void clear();
     void applyInvert();
@@ -86,23 +108,46 @@ public:
 private:
     std::shared_ptr<RingBuffer<float>> m_ringBuffer;
     std::unique_ptr<Synth> m_synth;
+    std::unique_ptr<RenderAheadWorker> m_renderAhead;
+    int m_renderAheadBlocks = 0;
+    // Frames of synth output played so far, the clock for the playhead and
+    // for timing messages to the synth.
+    std::atomic<int64_t> m_playedFrames { 0 };
     PortAudioBackend m_audioBackend;
 
     SDL_Window* m_window;
     SDL_Renderer* m_renderer;
     SDL_Texture* m_texture;
     Uint32* m_pixels;
+    int m_imageHeight;
+    // The pixels by column, for playback. Pixels changed since it was last
+    // brought up to date lie between (m_dirtyX1, m_dirtyY1) and
+    // (m_dirtyX2, m_dirtyY2), inclusive, an empty rectangle when
+    // m_dirtyX1 > m_dirtyX2.
+    std::unique_ptr<ColumnMirror> m_columns;
+    int m_dirtyX1 = 0;
+    int m_dirtyY1 = 0;
+    int m_dirtyX2 = -1;
+    int m_dirtyY2 = -1;
     std::unique_ptr<GUI> m_gui;
 
+    Tuning m_tuning;
+    std::string m_tuningDescription;
+    std::vector<float> m_amplitudeMessage;
+
     bool m_leftMouseButtonDown = false;
     int m_lastMouseX = -1;
     int m_lastMouseY = -1;
 
     bool m_playing = false;
     float m_position = 0;
+    // m_playedFrames when m_position was last updated.
+    int64_t m_positionFrame = 0;
     float m_speedInPixelsPerSecond = 100;
 
     float m_overallGain = 0.05;
+    float m_cpuBudget = 0;
+    std::string m_stemCacheDirectory;
 
     Mode m_mode = Mode::Draw;
 
@@ -116,22 +161,35 @@ private:
 
     int m_pdMode = 0;
     float m_pdDistort = 0.0;
+    SynthEngine m_engine = SynthEngine::Oscillators;
 
     std::random_device m_randomDevice;
     std::mt19937 m_randomEngine;
+    // Renders draw oscillator phases from an engine seeded with this, so
+    // the stems of unchanged rows stay valid for the whole session.
+    unsigned m_renderSeed;
 
     void initSDL();
     void initWindow();
     void initRenderer();
     void initGUI();
     void initAudio();
+    // Replaces the synth, and the render-ahead worker if there is one. The
+    // audio callback must not be using them.
+    void createSynth(const Tuning& tuning);
+    void updatePosition();
+    void createTexture();
+    void markDirty(int x1, int y1, int x2, int y2);
+    void markAllDirty();
+    void updateColumns();
     void mainLoop();
     void drawPixel(int x, int y, float red, float green, float blue, float alpha);
     void drawFuzzyCircle(int x, int y, int radius, float red, float green, float blue, float alpha);
     void drawLine(int x1, int y1, int x2, int y2, int radius, float red, float green, float blue, float alpha);
     void spray(int x, int y, float radius, float density, float red, float green, float blue, float alpha);
     void sprayLine(int x1, int y1, int x2, int y2, int radius, float density, float red, float green, float blue, float alpha);
-    void handleEvents();
+    // Returns false once the window has been asked to close.
+    bool handleEvents();
     void handleEventDrawEraseAndSpray(SDL_Event& event);
     void handleEventHorizontalLine(SDL_Event& event);
     void sendAmplitudesToAudioThread();
@@ -0,0 +1,64 @@
+#include "ColumnMirror.hpp"
+
+// Side of the square tiles the image is transposed in. A tile's pixels and
+// amplitudes both stay in cache while it is transposed.
+constexpr int k_tileSize = 16;
+
+ColumnMirror::ColumnMirror(int width, int height)
+    : m_width(width)
+    , m_height(height)
+    , m_amplitudes(2 * width * height)
+{
+}
+
+void ColumnMirror::update(Image image, int x1, int y1, int x2, int y2)
+{
+    uint32_t* pixels = std::get<0>(image);
+    x1 = std::max(x1, 0);
+    y1 = std::max(y1, 0);
+    x2 = std::min(x2, m_width - 1);
+    y2 = std::min(y2, m_height - 1);
+
+    float blue[k_tileSize];
+    float red[k_tileSize];
+    for (int tileY = y1; tileY <= y2; tileY += k_tileSize) {
+        for (int tileX = x1; tileX <= x2; tileX += k_tileSize) {
+            int tileWidth = std::min(k_tileSize, x2 + 1 - tileX);
+            int tileHeight = std::min(k_tileSize, y2 + 1 - tileY);
+            for (int y = tileY; y < tileY + tileHeight; y++) {
+                // Unpack a run of the row, which vectorizes, then scatter it
+                // into the columns.
+                const uint32_t* row = pixels + m_width * y + tileX;
+                for (int i = 0; i < tileWidth; i++) {
+                    blue[i] = (row[i] & 0xff) / 255.f;
+                    red[i] = ((row[i] >> 16) & 0xff) / 255.f;
+                }
+                float* out = &m_amplitudes[2 * (m_height * tileX + m_height - 1 - y)];
+                for (int i = 0; i < tileWidth; i++) {
+                    out[2 * m_height * i] = blue[i];
+                    out[2 * m_height * i + 1] = red[i];
+                }
+            }
+        }
+    }
+}
+
+void ColumnMirror::updateAll(Image image)
+{
+    update(image, 0, 0, m_width - 1, m_height - 1);
+}
+
+std::vector<int> ColumnMirror::findRuns(int firstRow, int numRows) const
+{
+    std::vector<int> runs(m_width);
+    int runStart = 0;
+    for (int x = 0; x < m_width; x++) {
+        const float* previous = getColumn(runStart) + 2 * firstRow;
+        const float* column = getColumn(x) + 2 * firstRow;
+        if (!std::equal(column, column + 2 * numRows, previous)) {
+            runStart = x;
+        }
+        runs[x] = runStart;
+    }
+    return runs;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <vector>
+
+#include "common.hpp"
+
+// The amplitudes an image plays, stored column by column.
+//
+// Playback reads one column of the image at a time, which in the row-major
+// image means one cache line per row. The mirror unpacks each pixel's blue
+// and red into left and right amplitudes once, when the pixel changes, and
+// keeps each column's amplitudes together.
+class ColumnMirror {
+public:
+    ColumnMirror(int width, int height);
+
+    // Unpacks the pixels in the rectangle between (x1, y1) and (x2, y2),
+    // inclusive, clipped to the image, which must be width by height.
+    void update(Image image, int x1, int y1, int x2, int y2);
+    void updateAll(Image image);
+
+    // Left and right amplitude of each row at column x, interleaved, from the
+    // bottom row up: 2 * height floats in [0, 1], the same as
+    // getBlueNormalized and getRedNormalized of the pixels.
+    const float* getColumn(int x) const { return &m_amplitudes[2 * m_height * x]; };
+
+    // Run-length encodes the columns, looking only at numRows rows from
+    // firstRow, counting from the bottom: for each column, the first column
+    // of the run of identical columns it belongs to.
+    std::vector<int> findRuns(int firstRow, int numRows) const;
+
+private:
+    const int m_width;
+    const int m_height;
+    std::vector<float> m_amplitudes;
+};
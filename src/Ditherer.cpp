@@ -0,0 +1,45 @@
+#include "Ditherer.hpp"
+
+Ditherer::Ditherer(int bitDepth)
+    : m_bitDepth(bitDepth)
+{
+}
+
+// A cheap integer hash with good avalanche (from Chris Wellons' "hash
+// prospector"). Every operation is a 32-bit shift, xor, or multiply, all of
+// which SIMD instruction sets have.
+static inline uint32_t hash(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+void Ditherer::process(const float* in, int32_t* out, int numSamples)
+{
+    // In double, so that adding the dither and rounding are exact even at 24
+    // bits.
+    const double scale = 1 << (m_bitDepth - 1);
+    const double lowest = -scale;
+    const double highest = scale - 1;
+    const int shift = 32 - m_bitDepth;
+    const uint32_t position = m_position;
+    for (int i = 0; i < numSamples; i++) {
+        // Two independent 16-bit uniforms, whose sum is triangular in
+        // (-1, 1) LSB.
+        uint32_t noise = hash(position + i);
+        int noiseSum = static_cast<int>(noise & 0xffff) + static_cast<int>(noise >> 16);
+        double dither = (noiseSum - 0xffff) * (1.0 / 0x10000);
+        double value = in[i] * scale + dither;
+        value = value < lowest ? lowest : value;
+        value = value > highest ? highest : value;
+        // Offsetting to non-negative makes truncation round down, and
+        // adding a half turns that into rounding to nearest.
+        int32_t rounded = static_cast<int32_t>(value + (scale + 0.5)) - static_cast<int32_t>(scale);
+        out[i] = static_cast<int32_t>(static_cast<uint32_t>(rounded) << shift);
+    }
+    m_position = position + numSamples;
+}
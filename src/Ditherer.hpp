@@ -0,0 +1,26 @@
+#pragma once
+#include <cstdint>
+
+// Converts float samples to integers of a lower bit depth with triangular
+// (TPDF) dither, so that quantization error becomes steady noise instead of
+// distortion that follows the signal.
+//
+// The noise comes from hashing each sample's position in the stream rather
+// than from a generator with state, so the loop has no dependency from one
+// sample to the next and vectorizes, and the result doesn't depend on how
+// the stream is split into calls.
+class Ditherer {
+public:
+    // bitDepth is at most 24.
+    Ditherer(int bitDepth);
+
+    // Converts the next numSamples samples, nominally in [-1, 1], clipping
+    // those outside. The results are scaled to the full range of an int32,
+    // with the bits below bitDepth zero, which is what sf_write_int expects
+    // for a file of that bit depth.
+    void process(const float* in, int32_t* out, int numSamples);
+
+private:
+    int m_bitDepth;
+    uint32_t m_position = 0;
+};
@@ -124,6 +124,11 @@ GUI::GUI(App* app, SDL_Window* pwindow, int width, int height)
         m_app->setSpeedInPixelsPerSecond(value * 200);
     });
 
+    auto& status = nwindow.widget().withLayout<sdlgui::BoxLayout>(
+        sdlgui::Orientation::Horizontal, sdlgui::Alignment::Middle, 0, 5
+    );
+    m_audioLoad = &status.label("CPU 0%");
+
     ////////////////
 
     nwindow.label("Synth");
@@ -142,6 +147,46 @@ GUI::GUI(App* app, SDL_Window* pwindow, int width, int height)
         }
     );
 
+    m_engine = std::make_unique<sdlgui::DropdownBox>(
+        &nwindow,
+        std::vector<std::string> { "Oscillators", "Inverse FFT", "Auto Engine" }
+    );
+    m_engine->setCallback([this](int engine) {
+        m_app->setEngine(static_cast<SynthEngine>(engine));
+    });
+
+    auto& tuningButton = nwindow.popupbutton("Tuning");
+    auto& tuningPopup = tuningButton.popup().withLayout<sdlgui::GroupLayout>();
+
+    tuningPopup.label("edo:24, edo:31:55, range:20:20000, or hz:110,220,330");
+    m_tuningDescription = std::make_unique<sdlgui::TextBox>(
+        &tuningPopup, m_app->getTuningDescription()
+    );
+    m_tuningDescription->withAlignment(sdlgui::TextBox::Alignment::Left);
+    m_tuningDescription->setEditable(true);
+
+    tuningPopup.label("Rows (edo and range)");
+    m_tuningRows = std::make_unique<sdlgui::TextBox>(
+        &tuningPopup, std::to_string(m_app->getNumRows())
+    );
+    m_tuningRows->withAlignment(sdlgui::TextBox::Alignment::Left);
+    m_tuningRows->setEditable(true);
+
+    tuningPopup.button("Apply", [this, &tuningButton] {
+        int numRows;
+        try {
+            numRows = std::stoi(m_tuningRows->value());
+        } catch (std::logic_error e) {
+            displayError("Invalid number of rows: '" + m_tuningRows->value() + "'");
+            return;
+        }
+        bool success = m_app->setTuning(m_tuningDescription->value(), numRows);
+        if (success) {
+            m_tuningRows->setValue(std::to_string(m_app->getNumRows()));
+            tuningButton.setPushed(false);
+        }
+    });
+
     ////////////////
 
     nwindow.label("File");
@@ -158,7 +203,8 @@ GUI::GUI(App* app, SDL_Window* pwindow, int width, int height)
 
     loadAudioPopup.button("Browse...", [this] {
         const std::vector<std::pair<std::string, std::string>> fileTypes = {
-            { "wav", "WAV files" }
+            { "wav", "WAV files" },
+            { "flac", "FLAC files" }
         };
         try {
             m_loadAudioPath->setValue(sdlgui::file_dialog(fileTypes, false));
@@ -186,7 +232,8 @@ GUI::GUI(App* app, SDL_Window* pwindow, int width, int height)
 
     renderAudioPopup.button("Browse...", [this] {
         const std::vector<std::pair<std::string, std::string>> fileTypes = {
-            { "wav", "WAV files" }
+            { "wav", "WAV files" },
+            { "flac", "FLAC files" }
         };
         try {
             m_renderAudioPath->setValue(sdlgui::file_dialog(fileTypes, true));
@@ -196,7 +243,15 @@ GUI::GUI(App* app, SDL_Window* pwindow, int width, int height)
     });
 
     renderAudioPopup.button("Render", [this, &renderAudioButton] {
-        bool success = m_app->renderAudio(m_renderAudioPath->value());
+        bool success = m_app->renderAudio(m_renderAudioPath->value(), false);
+        if (success) {
+            renderAudioButton.setPushed(false);
+        }
+    });
+
+    // Drafts get "-draft" added to the file name.
+    renderAudioPopup.button("Quick Bounce to -draft File", [this, &renderAudioButton] {
+        bool success = m_app->renderAudio(m_renderAudioPath->value(), true);
         if (success) {
             renderAudioButton.setPushed(false);
         }
@@ -404,3 +459,12 @@ void GUI::displayError(std::string message)
 {
     msgdialog(sdlgui::MessageDialog::Type::Warning, "Error", message);
 }
+
+void GUI::setAudioLoad(float load, int numCulled)
+{
+    std::string caption = "CPU " + std::to_string(static_cast<int>(load * 100 + 0.5)) + "%";
+    if (numCulled > 0) {
+        caption += ", " + std::to_string(numCulled) + " partials culled";
+    }
+    m_audioLoad->setCaption(caption);
+}
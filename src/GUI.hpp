@@ -66,12 +66,16 @@ public:
     int getWindowWidth() { return m_windowWidth; }
 
     void displayError(std::string message);
+    // Shows the audio thread's load, as a fraction of its time budget per
+    // callback, and how many partials it is culling to keep up.
+    void setAudioLoad(float load, int numCulled);
 
 private:
     App* m_app;
     int m_windowWidth;
 
     sdlgui::Button* m_drawButton;
+    sdlgui::Label* m_audioLoad;
 
     std::unique_ptr<SliderTextBox> m_brushSize;
     std::unique_ptr<SliderTextBox> m_colorRed;
@@ -81,6 +85,9 @@ private:
 
     std::unique_ptr<sdlgui::DropdownBox> m_pdMode;
     std::unique_ptr<SliderTextBox> m_pdDistort;
+    std::unique_ptr<sdlgui::DropdownBox> m_engine;
+    std::unique_ptr<sdlgui::TextBox> m_tuningDescription;
+    std::unique_ptr<sdlgui::TextBox> m_tuningRows;
 
     std::unique_ptr<sdlgui::TextBox> m_loadAudioPath;
     std::unique_ptr<sdlgui::TextBox> m_renderAudioPath;
@@ -0,0 +1,67 @@
+#include <cmath>
+
+#include "HalfBandUpsampler.hpp"
+
+constexpr double k_pi = 3.14159265358979323846;
+constexpr double k_kaiserBeta = 12;
+
+// Modified Bessel function of the first kind, order zero.
+static double besselI0(double x)
+{
+    double sum = 1;
+    double term = 1;
+    for (int k = 1; k < 50; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+HalfBandUpsampler::HalfBandUpsampler(int maxInputSize)
+    : m_buffer(k_numTaps + maxInputSize)
+{
+    // Odd taps of the half-band prototype sin(pi m / 2) / (pi m), which are
+    // the only nonzero ones besides the center. The window spans all 2 *
+    // k_numTaps - 1 prototype taps.
+    double sum = 0;
+    for (int k = 0; k < k_numTaps; k++) {
+        int m = 2 * (k - k_numTaps / 2) + 1;
+        double sinc = std::sin(k_pi * m / 2) / (k_pi * m);
+        double x = static_cast<double>(m) / k_numTaps;
+        double window = besselI0(k_kaiserBeta * std::sqrt(1 - x * x)) / besselI0(k_kaiserBeta);
+        m_coefficients[k] = sinc * window;
+        sum += sinc * window;
+    }
+    // Unity gain at DC, so the odd phase matches the even one.
+    for (int k = 0; k < k_numTaps; k++) {
+        m_coefficients[k] /= sum;
+    }
+}
+
+void HalfBandUpsampler::reset()
+{
+    for (int i = 0; i < k_numTaps; i++) {
+        m_buffer[i] = 0;
+    }
+}
+
+void HalfBandUpsampler::processAdd(const float* in, int numInput, float* out)
+{
+    float* buffer = m_buffer.data();
+    for (int n = 0; n < numInput; n++) {
+        buffer[k_numTaps + n] = in[n];
+    }
+    for (int n = 0; n < numInput; n++) {
+        // Newest sample last, so that x[k_numTaps - 1] is in[n].
+        const float* x = buffer + n + 1;
+        float odd = 0;
+        for (int k = 0; k < k_numTaps; k++) {
+            odd += m_coefficients[k] * x[k];
+        }
+        out[2 * n] += x[k_numTaps / 2 - 1];
+        out[2 * n + 1] += odd;
+    }
+    for (int i = 0; i < k_numTaps; i++) {
+        buffer[i] = buffer[numInput + i];
+    }
+}
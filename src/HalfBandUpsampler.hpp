@@ -0,0 +1,31 @@
+#pragma once
+#include "AlignedBuffer.hpp"
+
+// Doubles the sample rate of a signal whose content lies below 0.2 times its
+// sample rate, with a Kaiser-windowed half-band FIR filter in polyphase form.
+// Images start at 0.8 times the input rate and are suppressed by about
+// 100 dB.
+//
+// Every other output sample is a delayed copy of the input, so the work per
+// input sample is one k_numTaps-tap dot product.
+class HalfBandUpsampler {
+public:
+    // Taps of the filter's odd phase; the full filter has 2 * k_numTaps - 1.
+    static constexpr int k_numTaps = 16;
+    // Delay in output samples: output 2n + k_delay lines up with input n.
+    static constexpr int k_delay = k_numTaps;
+
+    // maxInputSize is the most samples processAdd accepts at once.
+    explicit HalfBandUpsampler(int maxInputSize);
+
+    // Forgets past input, as if it had been silent.
+    void reset();
+
+    // Upsamples numInput samples and adds the 2 * numInput results to out.
+    void processAdd(const float* in, int numInput, float* out);
+
+private:
+    // Previous k_numTaps input samples, followed by the current input.
+    AlignedBuffer<float> m_buffer;
+    float m_coefficients[k_numTaps];
+};
@@ -0,0 +1,226 @@
+#include <algorithm>
+#include <cmath>
+
+#include "common.hpp"
+#include "fft.hpp"
+#include "InverseFFTSynth.hpp"
+
+constexpr int k_frameSize = 1024;
+constexpr int k_hopSize = k_frameSize / 4;
+constexpr int k_spectrumSize = k_frameSize / 2 + 1;
+// Half-width of the Blackman-Harris main lobe, in bins. Everything outside it
+// is below -92 dB and is dropped.
+constexpr int k_kernelHalfWidth = 4;
+constexpr int k_kernelOversampling = 64;
+constexpr double k_pi = 3.14159265358979323846;
+
+// 4-term Blackman-Harris window, periodic, peaking at n = k_frameSize / 2.
+static double blackmanHarris(int n)
+{
+    double x = 2 * k_pi * n / k_frameSize;
+    return (
+        0.35875
+        - 0.48829 * std::cos(x)
+        + 0.14128 * std::cos(2 * x)
+        - 0.01168 * std::cos(3 * x)
+    );
+}
+
+InverseFFTSynth::InverseFFTSynth(float sampleRate, int size)
+    : m_sampleRate(sampleRate)
+    , m_size(size)
+    , m_phases(size)
+    , m_hopIncrements(size)
+    , m_bins(size)
+    , m_targetAmplitudesLeft(size)
+    , m_targetAmplitudesRight(size)
+    , m_kernel(k_kernelHalfWidth * k_kernelOversampling + 2)
+    , m_correctionWindow(k_frameSize / 2)
+    , m_overlapLeft(k_frameSize / 2)
+    , m_overlapRight(k_frameSize / 2)
+    , m_readPosition(k_hopSize)
+{
+    // Spectrum of the zero-phase window at fractional bin offsets. Divided by
+    // the frame size because FFTW's inverse transform is unnormalized, and by
+    // 2 because a real sine is the sum of two complex exponentials.
+    for (int i = 0; i < m_kernel.size(); i++) {
+        double offset = static_cast<double>(i) / k_kernelOversampling;
+        double sum = 0;
+        for (int n = 0; n < k_frameSize; n++) {
+            sum += blackmanHarris(n) * std::cos(
+                2 * k_pi * offset * (n - k_frameSize / 2) / k_frameSize
+            );
+        }
+        m_kernel[i] = sum / k_frameSize / 2;
+    }
+
+    // Only the middle half of each frame is used, where the window is large.
+    // Dividing out the window and applying a triangle makes consecutive
+    // frames sum to one at a hop of a quarter frame.
+    for (int i = 0; i < k_frameSize / 2; i++) {
+        float triangle = 1 - std::abs(i - k_hopSize) / static_cast<float>(k_hopSize);
+        m_correctionWindow[i] = triangle / blackmanHarris(k_frameSize / 4 + i);
+    }
+
+    m_plan = fft::getComplexToRealPlan(k_frameSize);
+    std::lock_guard<std::mutex> lock(getFFTWPlannerMutex());
+    m_spectrumLeft = fftwf_alloc_complex(k_spectrumSize);
+    m_spectrumRight = fftwf_alloc_complex(k_spectrumSize);
+    m_frameLeft = fftwf_alloc_real(k_frameSize);
+    m_frameRight = fftwf_alloc_real(k_frameSize);
+}
+
+InverseFFTSynth::~InverseFFTSynth()
+{
+    std::lock_guard<std::mutex> lock(getFFTWPlannerMutex());
+    fftwf_free(m_spectrumLeft);
+    fftwf_free(m_spectrumRight);
+    fftwf_free(m_frameLeft);
+    fftwf_free(m_frameRight);
+}
+
+void InverseFFTSynth::setIncrement(int index, float increment)
+{
+    m_hopIncrements[index] = static_cast<double>(increment) * k_hopSize;
+    m_bins[index] = increment * k_frameSize;
+}
+
+void InverseFFTSynth::setTargetAmplitude(
+    int index, float amplitudeLeft, float amplitudeRight
+)
+{
+    m_targetAmplitudesLeft[index] = amplitudeLeft;
+    m_targetAmplitudesRight[index] = amplitudeRight;
+}
+
+void InverseFFTSynth::reset(const float* phases)
+{
+    // Frames are cosines, so sin(2 pi p) becomes a frame phase of p - 1/4.
+    for (int i = 0; i < m_size; i++) {
+        m_phases[i] = phases[i] + 0.75;
+    }
+    for (int i = 0; i < k_frameSize / 2; i++) {
+        m_overlapLeft[i] = 0;
+        m_overlapRight[i] = 0;
+    }
+    // The first hop of a frame is only complete once the previous frame has
+    // been added. Synthesize the frame centered on the next sample now, and
+    // throw away its first hop, which lies in the past.
+    synthesizeFrame();
+    m_readPosition = k_hopSize;
+}
+
+void InverseFFTSynth::processAdd(float* out1, float* out2, int blockSize)
+{
+    int written = 0;
+    while (written < blockSize) {
+        if (m_readPosition == k_hopSize) {
+            synthesizeFrame();
+            m_readPosition = 0;
+        }
+        int count = std::min(blockSize - written, k_hopSize - m_readPosition);
+        for (int i = 0; i < count; i++) {
+            out1[written + i] += m_overlapLeft[m_readPosition + i];
+            out2[written + i] += m_overlapRight[m_readPosition + i];
+        }
+        m_readPosition += count;
+        written += count;
+    }
+}
+
+int InverseFFTSynth::getLatency(int blockSize)
+{
+    // A change waits (k_hopSize - blockSize) / 2 frames for the next hop on
+    // average, and is halfway in half a hop later. A ramp over the block is
+    // halfway after half a block.
+    return std::max(k_hopSize - blockSize, 0);
+}
+
+void InverseFFTSynth::synthesizeFrame()
+{
+    const int overlapSize = k_frameSize / 2;
+    for (int i = 0; i < overlapSize - k_hopSize; i++) {
+        m_overlapLeft[i] = m_overlapLeft[i + k_hopSize];
+        m_overlapRight[i] = m_overlapRight[i + k_hopSize];
+    }
+    for (int i = overlapSize - k_hopSize; i < overlapSize; i++) {
+        m_overlapLeft[i] = 0;
+        m_overlapRight[i] = 0;
+    }
+
+    for (int bin = 0; bin < k_spectrumSize; bin++) {
+        m_spectrumLeft[bin][0] = m_spectrumLeft[bin][1] = 0;
+        m_spectrumRight[bin][0] = m_spectrumRight[bin][1] = 0;
+    }
+
+    for (int i = 0; i < m_size; i++) {
+        if (m_targetAmplitudesLeft[i] != 0 || m_targetAmplitudesRight[i] != 0) {
+            addPartial(i);
+        }
+        m_phases[i] += m_hopIncrements[i];
+        m_phases[i] -= std::floor(m_phases[i]);
+    }
+
+    // Alternating signs move the frame's center from sample 0 to the middle.
+    for (int bin = 1; bin < k_spectrumSize; bin += 2) {
+        m_spectrumLeft[bin][0] = -m_spectrumLeft[bin][0];
+        m_spectrumLeft[bin][1] = -m_spectrumLeft[bin][1];
+        m_spectrumRight[bin][0] = -m_spectrumRight[bin][0];
+        m_spectrumRight[bin][1] = -m_spectrumRight[bin][1];
+    }
+
+    fftwf_execute_dft_c2r(m_plan, m_spectrumLeft, m_frameLeft);
+    fftwf_execute_dft_c2r(m_plan, m_spectrumRight, m_frameRight);
+
+    for (int i = 0; i < overlapSize; i++) {
+        m_overlapLeft[i] += m_frameLeft[k_frameSize / 4 + i] * m_correctionWindow[i];
+        m_overlapRight[i] += m_frameRight[k_frameSize / 4 + i] * m_correctionWindow[i];
+    }
+}
+
+void InverseFFTSynth::addPartial(int index)
+{
+    float centerBin = m_bins[index];
+    double phase = 2 * k_pi * m_phases[index];
+    float real = std::cos(phase);
+    float imaginary = std::sin(phase);
+    float amplitudeLeft = m_targetAmplitudesLeft[index];
+    float amplitudeRight = m_targetAmplitudesRight[index];
+
+    int firstBin = std::ceil(centerBin - k_kernelHalfWidth);
+    int lastBin = std::floor(centerBin + k_kernelHalfWidth);
+    for (int bin = firstBin; bin <= lastBin; bin++) {
+        float position = std::abs(bin - centerBin) * k_kernelOversampling;
+        int integerPosition = position;
+        float frac = position - integerPosition;
+        float weight = (
+            m_kernel[integerPosition] * (1 - frac)
+            + m_kernel[integerPosition + 1] * frac
+        );
+        float valueReal = real * weight;
+        float valueImaginary = imaginary * weight;
+
+        // Bins outside [0, N/2] belong to the mirrored negative-frequency half
+        // of the spectrum, which is the complex conjugate.
+        int targetBin = bin;
+        if (bin < 0) {
+            targetBin = -bin;
+            valueImaginary = -valueImaginary;
+        } else if (bin > k_frameSize / 2) {
+            targetBin = k_frameSize - bin;
+            valueImaginary = -valueImaginary;
+        } else if (bin == 0 || bin == k_frameSize / 2) {
+            // A purely real bin receives both halves.
+            valueReal *= 2;
+            valueImaginary = 0;
+        }
+        if (targetBin < 0 || targetBin >= k_spectrumSize) {
+            continue;
+        }
+
+        m_spectrumLeft[targetBin][0] += valueReal * amplitudeLeft;
+        m_spectrumLeft[targetBin][1] += valueImaginary * amplitudeLeft;
+        m_spectrumRight[targetBin][0] += valueReal * amplitudeRight;
+        m_spectrumRight[targetBin][1] += valueImaginary * amplitudeRight;
+    }
+}
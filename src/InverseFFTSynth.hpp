@@ -0,0 +1,73 @@
+#pragma once
+#include <fftw3.h>
+
+#include "AlignedBuffer.hpp"
+
+// Additive synthesis by inverse FFT and overlap-add, after Rodet & Depalle,
+// "Spectral Envelopes and Inverse FFT Synthesis" (1992).
+//
+// Every hop, each partial's windowed spectrum (a 9-bin Blackman-Harris main
+// lobe centered on its exact, fractional bin) is added into one spectrum per
+// channel. One inverse FFT per channel then yields all partials at once, so
+// the cost per sample is nearly independent of the number of partials.
+// Frames are cross-faded with triangular windows, which also interpolates
+// amplitudes linearly from one hop to the next.
+//
+// Only pure sines are produced; phase distortion is not applied. Output is
+// phase-compatible with OscillatorBank, so the two can be cross-faded.
+class InverseFFTSynth {
+public:
+    InverseFFTSynth(float sampleRate, int size);
+    ~InverseFFTSynth();
+
+    InverseFFTSynth(const InverseFFTSynth&) = delete;
+    InverseFFTSynth& operator=(const InverseFFTSynth&) = delete;
+
+    int size() { return m_size; };
+
+    // Phase increment per sample, in cycles.
+    void setIncrement(int index, float increment);
+    void setTargetAmplitude(int index, float amplitudeLeft, float amplitudeRight);
+
+    // Restarts synthesis so that the next output sample of partial i is
+    // sin(2 pi phases[i]).
+    void reset(const float* phases);
+
+    void processAdd(float* out1, float* out2, int blockSize);
+
+    // Frames by which amplitude changes set every blockSize frames play late
+    // on average, compared with ramping over the block they are set in. A
+    // change waits for the next hop, then fades in over a whole one.
+    static int getLatency(int blockSize);
+
+private:
+    const float m_sampleRate;
+    const int m_size;
+
+    // Frame phase in cycles at the center of the next frame, and per-hop
+    // increment. Kept in double so hour-long renders don't drift.
+    AlignedBuffer<double> m_phases;
+    AlignedBuffer<double> m_hopIncrements;
+    AlignedBuffer<float> m_bins;
+    AlignedBuffer<float> m_targetAmplitudesLeft;
+    AlignedBuffer<float> m_targetAmplitudesRight;
+
+    AlignedBuffer<float> m_kernel;
+    AlignedBuffer<float> m_correctionWindow;
+
+    fftwf_complex* m_spectrumLeft;
+    fftwf_complex* m_spectrumRight;
+    float* m_frameLeft;
+    float* m_frameRight;
+    // Shared with the rest of the process, and used for both channels.
+    fftwf_plan m_plan;
+
+    // Overlap-add accumulators. The first hop is ready to be played once a
+    // frame has been added.
+    AlignedBuffer<float> m_overlapLeft;
+    AlignedBuffer<float> m_overlapRight;
+    int m_readPosition;
+
+    void synthesizeFrame();
+    void addPartial(int index);
+};
@@ -0,0 +1,79 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+
+// Number of phase distortion modes: pulsar, saw, square, PWM.
+constexpr int k_numPDModes = 4;
+
+// Maps a phase in [0, 1) to the phase at which the sine table is read. Every
+// mode is the identity at zero distortion.
+//
+// The mode is a template parameter so that render loops can be instantiated
+// once per mode. Piecewise shapes select between their segments instead of
+// branching, which lets the compiler vectorize them.
+template <int mode>
+inline float distortPhase(float phase, float distort)
+{
+    switch (mode) {
+    case 0: // Pulsar
+        return std::min(phase * (1 + 6 * distort * distort), 1.f);
+    case 1: // Saw
+        {
+            float breakpoint = 0.25 * (1 - distort * 0.9);
+            float outerSlope = 0.25 / breakpoint;
+            float innerSlope = 0.5 / (1 - breakpoint * 2);
+            float rising = phase * outerSlope;
+            float falling = 1 - (1 - phase) * outerSlope;
+            float middle = 0.5 + (phase - 0.5) * innerSlope;
+            return phase < breakpoint ? rising : (phase >= 1 - breakpoint ? falling : middle);
+        }
+    case 2: // Square
+        {
+            // Phase is in [0, 1), so a conditional subtraction is the same
+            // as std::fmod(..., 1.0f) here and below.
+            float cosinePhase = phase + 0.25f;
+            cosinePhase = cosinePhase >= 1 ? cosinePhase - 1 : cosinePhase;
+
+            float adjustedDistort = distort * 0.9;
+            float breakpoint = adjustedDistort * 0.5;
+            float slope = 1 / (1 - adjustedDistort);
+
+            float firstRamp = (cosinePhase - breakpoint) * slope;
+            float secondRamp = 0.5 + (cosinePhase - (0.5 + breakpoint)) * slope;
+            cosinePhase = (
+                cosinePhase < breakpoint ? 0
+                : cosinePhase < 0.5f ? firstRamp
+                : cosinePhase < 0.5f + breakpoint ? 0.5f
+                : secondRamp
+            );
+
+            float result = cosinePhase - 0.25f + 1.0f;
+            return result >= 1 ? result - 1 : result;
+        }
+    case 3: // PWM
+        {
+            float adjustedDistort = distort * 0.9;
+            float breakpoint = 0.5 + 0.5 * adjustedDistort;
+            float first = phase * 0.5 / breakpoint;
+            float second = 0.5 + (phase - breakpoint) * 0.5 / (1 - breakpoint);
+            return phase < breakpoint ? first : second;
+        }
+    }
+    return phase;
+}
+
+// Same, with the mode chosen at runtime.
+inline float distortPhase(float phase, int mode, float distort)
+{
+    switch (mode) {
+    case 0:
+        return distortPhase<0>(phase, distort);
+    case 1:
+        return distortPhase<1>(phase, distort);
+    case 2:
+        return distortPhase<2>(phase, distort);
+    case 3:
+        return distortPhase<3>(phase, distort);
+    }
+    return phase;
+}
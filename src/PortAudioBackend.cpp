@@ -46,6 +46,14 @@ void PortAudioBackend::end() {
     handle_error(Pa_Terminate());
 }
 
+void PortAudioBackend::pause() {
+    handle_error(Pa_StopStream(m_stream));
+}
+
+void PortAudioBackend::resume() {
+    handle_error(Pa_StartStream(m_stream));
+}
+
 void PortAudioBackend::process(
     const float** input_buffer,
     float** output_buffer,
@@ -16,9 +16,14 @@ public:
     );
 
     float getSampleRate() { return m_sample_rate; };
+    int getBlockSize() { return m_block_size; };
 
     void run();
     void end();
+    // Stops and restarts the stream. Once pause() returns, the callback isn't
+    // running and won't be called until resume().
+    void pause();
+    void resume();
     void process(
         const float** input_buffer,
         float** output_buffer,
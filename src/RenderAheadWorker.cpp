@@ -0,0 +1,141 @@
+#include <algorithm>
+
+#include "common.hpp"
+#include "RenderAheadWorker.hpp"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+AudioFifo::AudioFifo(int capacity)
+    : m_capacity(nextPowerOfTwo(capacity))
+    , m_left(m_capacity)
+    , m_right(m_capacity)
+{
+}
+
+int AudioFifo::getReadAvailable()
+{
+    return m_writeCount.load(std::memory_order_acquire)
+        - m_readCount.load(std::memory_order_relaxed);
+}
+
+int AudioFifo::getWriteAvailable()
+{
+    return m_capacity - static_cast<int>(
+        m_writeCount.load(std::memory_order_relaxed)
+        - m_readCount.load(std::memory_order_acquire)
+    );
+}
+
+int AudioFifo::write(const float* left, const float* right, int numFrames)
+{
+    numFrames = std::min(numFrames, getWriteAvailable());
+    uint64_t writeCount = m_writeCount.load(std::memory_order_relaxed);
+    for (int i = 0; i < numFrames; i++) {
+        int index = (writeCount + i) & (m_capacity - 1);
+        m_left[index] = left[i];
+        m_right[index] = right[i];
+    }
+    m_writeCount.store(writeCount + numFrames, std::memory_order_release);
+    return numFrames;
+}
+
+int AudioFifo::read(float* left, float* right, int numFrames)
+{
+    numFrames = std::min(numFrames, getReadAvailable());
+    uint64_t readCount = m_readCount.load(std::memory_order_relaxed);
+    for (int i = 0; i < numFrames; i++) {
+        int index = (readCount + i) & (m_capacity - 1);
+        if (right == nullptr) {
+            left[i] = 0.5f * (m_left[index] + m_right[index]);
+        } else {
+            left[i] = m_left[index];
+            right[i] = m_right[index];
+        }
+    }
+    m_readCount.store(readCount + numFrames, std::memory_order_release);
+    return numFrames;
+}
+
+// Gives the thread a realtime priority, just above normal threads and below
+// the audio callback, which audio APIs run at high realtime priorities. Best
+// effort: without the privilege to, the thread keeps its priority.
+static void raisePriority(std::thread& thread)
+{
+#if defined(_WIN32)
+    SetThreadPriority(thread.native_handle(), THREAD_PRIORITY_HIGHEST);
+#else
+    sched_param parameters;
+    parameters.sched_priority = sched_get_priority_min(SCHED_FIFO) + 1;
+    pthread_setschedparam(thread.native_handle(), SCHED_FIFO, &parameters);
+#endif
+}
+
+RenderAheadWorker::RenderAheadWorker(
+    Synth& synth,
+    std::shared_ptr<RingBuffer<float>> ringBuffer,
+    int blockSize,
+    int numBlocks
+)
+    : m_synth(synth)
+    , m_ringBuffer(ringBuffer)
+    , m_blockSize(blockSize)
+    , m_latency(blockSize * numBlocks)
+    , m_fifo(m_latency + blockSize)
+    , m_blockLeft(blockSize)
+    , m_blockRight(blockSize)
+{
+    // Start full, so the latency is the same from the first callback on.
+    fill();
+    m_thread = std::thread(&RenderAheadWorker::run, this);
+    raisePriority(m_thread);
+}
+
+RenderAheadWorker::~RenderAheadWorker()
+{
+    m_stopping = true;
+    m_semaphore.post();
+    m_thread.join();
+}
+
+int RenderAheadWorker::process(int outputChannels, float** outputBuffer, int frameCount)
+{
+    float* right = outputChannels >= 2 ? outputBuffer[1] : nullptr;
+    int numRead = m_fifo.read(outputBuffer[0], right, frameCount);
+    if (numRead < frameCount) {
+        m_numUnderruns++;
+    }
+    // Pad the stereo channels after what was read, and silence any others.
+    for (int channel = 0; channel < outputChannels; channel++) {
+        int first = channel < 2 ? numRead : 0;
+        for (int i = first; i < frameCount; i++) {
+            outputBuffer[channel][i] = 0;
+        }
+    }
+    m_semaphore.post();
+    return numRead;
+}
+
+void RenderAheadWorker::fill()
+{
+    float* block[2] = { m_blockLeft.data(), m_blockRight.data() };
+    while (m_fifo.getReadAvailable() < m_latency) {
+        m_synth.processRealtime(2, block, m_blockSize, m_ringBuffer);
+        m_fifo.write(m_blockLeft.data(), m_blockRight.data(), m_blockSize);
+    }
+}
+
+void RenderAheadWorker::run()
+{
+    while (true) {
+        m_semaphore.wait();
+        if (m_stopping) {
+            return;
+        }
+        fill();
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "RingBuffer.hpp"
+#include "Synth.hpp"
+#include "WorkerPool.hpp"
+
+// FIFO of stereo frames from one writing thread to one reading thread.
+// Neither side blocks or takes a lock.
+class AudioFifo {
+public:
+    // Holds at least capacity frames.
+    explicit AudioFifo(int capacity);
+
+    int getReadAvailable();
+    int getWriteAvailable();
+
+    // Copy up to numFrames frames in or out. Return the number copied. A
+    // null right makes read mix both channels down into left.
+    int write(const float* left, const float* right, int numFrames);
+    int read(float* left, float* right, int numFrames);
+
+private:
+    const int m_capacity;
+    std::vector<float> m_left;
+    std::vector<float> m_right;
+    // Frames written and read so far. Kept on separate cache lines, since
+    // each is only written by one side.
+    alignas(64) std::atomic<uint64_t> m_writeCount { 0 };
+    alignas(64) std::atomic<uint64_t> m_readCount { 0 };
+};
+
+// Renders a synth's realtime output on its own high-priority thread, a fixed
+// number of blocks ahead of the audio callback, which only copies samples out
+// of a FIFO. That adds latency, but lets synthesis ride out CPU spikes longer
+// than one callback.
+//
+// Messages in the ring buffer are timed by frames of synth output. The FIFO
+// starts out full, so frame n is heard when the callback has taken n frames
+// out of it; messages meant to be heard at a given moment should be timed
+// getLatency() frames after what has been taken out at the time.
+class RenderAheadWorker {
+public:
+    // The synth and ring buffer are used from the worker thread until the
+    // worker is destroyed.
+    RenderAheadWorker(
+        Synth& synth,
+        std::shared_ptr<RingBuffer<float>> ringBuffer,
+        int blockSize,
+        int numBlocks
+    );
+    ~RenderAheadWorker();
+
+    RenderAheadWorker(const RenderAheadWorker&) = delete;
+    RenderAheadWorker& operator=(const RenderAheadWorker&) = delete;
+
+    int getLatency() { return m_latency; };
+    // Callbacks that found the FIFO short of frames.
+    int getNumUnderruns() { return m_numUnderruns.load(); };
+
+    // For the audio callback. Copies the next frames out of the FIFO,
+    // padding with silence if the worker has fallen behind, and returns the
+    // number of frames of synth output copied. A mono output gets both
+    // channels mixed down; channels past the second are silent.
+    int process(int outputChannels, float** outputBuffer, int frameCount);
+
+private:
+    Synth& m_synth;
+    std::shared_ptr<RingBuffer<float>> m_ringBuffer;
+    const int m_blockSize;
+    const int m_latency;
+    AudioFifo m_fifo;
+    std::vector<float> m_blockLeft;
+    std::vector<float> m_blockRight;
+
+    Semaphore m_semaphore;
+    std::atomic<bool> m_stopping { false };
+    std::atomic<int> m_numUnderruns { 0 };
+    std::thread m_thread;
+
+    void fill();
+    void run();
+};
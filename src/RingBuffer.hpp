@@ -1,4 +1,5 @@
 #pragma once
+#include <algorithm>
 #include <iostream>
 #include <memory>
 #include "pa_ringbuffer.h"
@@ -9,8 +10,17 @@ public:
     RingBuffer(int size);
     ~RingBuffer();
 
-    void write(T* inputBuffer, int count);
+    // Writes all count values, or nothing if they don't fit. Dropping the
+    // new values rather than the oldest means only the reader ever moves the
+    // read index, so it never sees part of a message overwritten. Returns
+    // whether the values were written.
+    bool write(T* inputBuffer, int count);
+    // Reads everything available, or at most count values, into the output
+    // buffer. Returns the number read.
     int read();
+    int read(int count);
+    int getReadAvailable() { return PaUtil_GetRingBufferReadAvailable(m_ringBuffer.get()); };
+    int getWriteAvailable() { return PaUtil_GetRingBufferWriteAvailable(m_ringBuffer.get()); };
 
     T* getOutputBuffer() { return m_outputBuffer; };
     int getOutputBufferSize() { return m_outputBufferSize; };
@@ -59,20 +69,25 @@ RingBuffer<T>::~RingBuffer()
 }
 
 template <class T>
-void RingBuffer<T>::write(T* inputBuffer, int count)
+bool RingBuffer<T>::write(T* inputBuffer, int count)
 {
-    auto writeAvailable = PaUtil_GetRingBufferWriteAvailable(m_ringBuffer.get());
-    if (count > writeAvailable) {
-        PaUtil_AdvanceRingBufferReadIndex(m_ringBuffer.get(), count);
+    if (getWriteAvailable() < count) {
+        return false;
     }
     PaUtil_WriteRingBuffer(m_ringBuffer.get(), inputBuffer, count);
+    return true;
 }
 
 template <class T>
 int RingBuffer<T>::read()
+{
+    return read(m_outputBufferSize);
+}
+
+template <class T>
+int RingBuffer<T>::read(int count)
 {
     int availableFrames = PaUtil_GetRingBufferReadAvailable(m_ringBuffer.get());
-    int readSamples = std::min(availableFrames, m_outputBufferSize);
-    int count = PaUtil_ReadRingBuffer(m_ringBuffer.get(), m_outputBuffer, readSamples);
-    return count;
+    int readSamples = std::min({ availableFrames, m_outputBufferSize, count });
+    return PaUtil_ReadRingBuffer(m_ringBuffer.get(), m_outputBuffer, readSamples);
 }
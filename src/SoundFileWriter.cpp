@@ -0,0 +1,75 @@
+#include "SoundFileWriter.hpp"
+
+SoundFileWriter::SoundFileWriter(SNDFILE* file, int maxFrames, int bitDepth)
+    : m_file(file)
+{
+    for (auto& buffer : m_buffers) {
+        buffer.resize(2 * maxFrames);
+    }
+    if (bitDepth != 0) {
+        m_ditherer = std::make_unique<Ditherer>(bitDepth);
+        m_ditheredBuffer.resize(2 * maxFrames);
+    }
+    m_thread = std::thread(&SoundFileWriter::run, this);
+}
+
+SoundFileWriter::~SoundFileWriter()
+{
+    finish();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_queued.notify_all();
+    m_thread.join();
+}
+
+void SoundFileWriter::write(int numFrames)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_written.wait(lock, [this] { return m_pendingFrames == 0; });
+    if (numFrames == 0) {
+        return;
+    }
+    m_pendingFrames = numFrames;
+    m_fillIndex = 1 - m_fillIndex;
+    lock.unlock();
+    m_queued.notify_one();
+}
+
+bool SoundFileWriter::finish()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_written.wait(lock, [this] { return m_pendingFrames == 0; });
+    return !m_failed;
+}
+
+void SoundFileWriter::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_queued.wait(lock, [this] { return m_stopping || m_pendingFrames != 0; });
+        if (m_stopping) {
+            return;
+        }
+        // write() doesn't touch the buffer it handed over, or the counts,
+        // until it is signaled.
+        int numFrames = m_pendingFrames;
+        const float* buffer = m_buffers[1 - m_fillIndex].data();
+        lock.unlock();
+        sf_count_t written;
+        if (m_ditherer) {
+            m_ditherer->process(buffer, m_ditheredBuffer.data(), 2 * numFrames);
+            written = sf_writef_int(m_file, m_ditheredBuffer.data(), numFrames);
+        } else {
+            written = sf_writef_float(m_file, buffer, numFrames);
+        }
+        lock.lock();
+
+        if (written != numFrames) {
+            m_failed = true;
+        }
+        m_pendingFrames = 0;
+        m_written.notify_all();
+    }
+}
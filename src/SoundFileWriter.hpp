@@ -0,0 +1,58 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sndfile.h>
+
+#include "Ditherer.hpp"
+
+// Writes interleaved stereo audio to a sound file on a background thread, so
+// that disk I/O overlaps synthesis.
+//
+// There are two buffers: the caller fills one while the other is written, and
+// write() trades them. Memory use stays at two buffers however long the file
+// gets.
+//
+// Given a bit depth, samples are dithered down to it on the background thread
+// and written as integers; otherwise they are written as floats.
+class SoundFileWriter {
+public:
+    // Buffers hold up to maxFrames frames. The file must stay open until
+    // finish() returns. A bitDepth of 0 writes floats.
+    SoundFileWriter(SNDFILE* file, int maxFrames, int bitDepth);
+    ~SoundFileWriter();
+
+    SoundFileWriter(const SoundFileWriter&) = delete;
+    SoundFileWriter& operator=(const SoundFileWriter&) = delete;
+
+    // The buffer to fill next. Valid until the next call to write().
+    float* getBuffer() { return m_buffers[m_fillIndex].data(); };
+    // Queues the first numFrames frames of the buffer for writing. Waits
+    // until the write before it is done.
+    void write(int numFrames);
+    // Waits for all queued writes. False if any of them failed.
+    bool finish();
+
+private:
+    SNDFILE* m_file;
+    std::vector<float> m_buffers[2];
+    int m_fillIndex = 0;
+    // Only with a bit depth.
+    std::unique_ptr<Ditherer> m_ditherer;
+    std::vector<int32_t> m_ditheredBuffer;
+
+    // Frames of the other buffer waiting to be written, 0 if none.
+    int m_pendingFrames = 0;
+    bool m_failed = false;
+    bool m_stopping = false;
+    std::mutex m_mutex;
+    std::condition_variable m_queued;
+    std::condition_variable m_written;
+
+    std::thread m_thread;
+
+    void run();
+};
@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif // _WIN32
+
+#include "common.hpp"
+#include "StemCache.hpp"
+
+// Identifies stem files. Bump the version when their layout changes.
+constexpr char k_magic[8] = { 'C', 'N', 'V', 'S', 'T', 'E', 'M', '1' };
+// Silent frames a stored stretch may span before it is split in two. Saves
+// headers when a row goes quiet for a moment.
+constexpr int k_maxSilentFrames = 1024;
+
+void StemKey::add(const void* data, size_t size)
+{
+    auto bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+        m_hash ^= bytes[i];
+        m_hash *= 1099511628211ull;
+    }
+}
+
+// Header of a stem file. Followed by numSegments stretches, each a Segment
+// and then 2 * length samples.
+struct StemHeader {
+    char magic[8];
+    uint64_t key;
+    int64_t numFrames;
+    int64_t numSegments;
+};
+
+struct Segment {
+    int64_t start;
+    int64_t length;
+};
+
+StemCache::StemCache(std::string directory)
+    : m_directory(directory)
+{
+}
+
+bool StemCache::open()
+{
+#ifdef _WIN32
+    _mkdir(m_directory.c_str());
+#else
+    mkdir(m_directory.c_str(), 0777);
+#endif // _WIN32
+    struct stat info;
+    return stat(m_directory.c_str(), &info) == 0 && (info.st_mode & S_IFDIR);
+}
+
+std::string StemCache::getPath(uint64_t key)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.stem", static_cast<unsigned long long>(key));
+    return m_directory + getPathSeparator() + name;
+}
+
+bool StemCache::addTo(uint64_t key, float* audio, int numFrames)
+{
+    std::ifstream file(getPath(key), std::ios::binary);
+    StemHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        return false;
+    }
+    if (
+        !std::equal(k_magic, k_magic + sizeof(k_magic), header.magic)
+        || header.key != key
+        || header.numFrames != numFrames
+    ) {
+        return false;
+    }
+
+    // Read everything before adding any of it, so a truncated file leaves
+    // the audio alone.
+    std::vector<Segment> segments;
+    std::vector<float> samples;
+    for (int64_t i = 0; i < header.numSegments; i++) {
+        Segment segment;
+        if (!file.read(reinterpret_cast<char*>(&segment), sizeof(segment))) {
+            return false;
+        }
+        if (
+            segment.start < 0
+            || segment.length < 0
+            || segment.start + segment.length > numFrames
+        ) {
+            return false;
+        }
+        size_t offset = samples.size();
+        samples.resize(offset + 2 * segment.length);
+        if (!file.read(
+            reinterpret_cast<char*>(samples.data() + offset),
+            2 * segment.length * sizeof(float)
+        )) {
+            return false;
+        }
+        segments.push_back(segment);
+    }
+
+    const float* in = samples.data();
+    for (auto& segment : segments) {
+        float* out = audio + 2 * segment.start;
+        for (int64_t i = 0; i < 2 * segment.length; i++) {
+            out[i] += in[i];
+        }
+        in += 2 * segment.length;
+    }
+    return true;
+}
+
+void StemCache::store(uint64_t key, const float* audio, int numFrames)
+{
+    std::vector<Segment> segments;
+    int silentFrames = k_maxSilentFrames;
+    for (int i = 0; i < numFrames; i++) {
+        if (audio[2 * i] == 0 && audio[2 * i + 1] == 0) {
+            silentFrames++;
+            continue;
+        }
+        if (silentFrames >= k_maxSilentFrames) {
+            segments.push_back(Segment { i, 0 });
+        }
+        segments.back().length = i + 1 - segments.back().start;
+        silentFrames = 0;
+    }
+
+    // Written under a temporary name and renamed, so an interrupted render
+    // doesn't leave a partial stem behind.
+    std::string path = getPath(key);
+    std::string temporaryPath = path + ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::binary);
+        StemHeader header;
+        std::copy(k_magic, k_magic + sizeof(k_magic), header.magic);
+        header.key = key;
+        header.numFrames = numFrames;
+        header.numSegments = segments.size();
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (auto& segment : segments) {
+            file.write(reinterpret_cast<const char*>(&segment), sizeof(segment));
+            file.write(
+                reinterpret_cast<const char*>(audio + 2 * segment.start),
+                2 * segment.length * sizeof(float)
+            );
+        }
+        if (!file) {
+            file.close();
+            std::remove(temporaryPath.c_str());
+            return;
+        }
+    }
+    std::remove(path.c_str());
+    std::rename(temporaryPath.c_str(), path.c_str());
+}
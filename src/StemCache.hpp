@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// 64-bit FNV-1a, built up from the pieces of a key.
+class StemKey {
+public:
+    void add(const void* data, size_t size);
+    template <class T>
+    void add(const T& value) { add(&value, sizeof(value)); }
+
+    uint64_t get() { return m_hash; }
+
+private:
+    uint64_t m_hash = 14695981039346656037ull;
+};
+
+// Rendered audio of single canvas rows, kept in a directory between renders.
+// The synth is additive, so a render can add up the stems of rows that
+// haven't changed instead of synthesizing them again.
+//
+// Stems are looked up by a key that hashes everything the row's audio
+// depends on. They are interleaved stereo, and only the stretches where the
+// row sounds are stored, so a cache costs about as much disk space as lit
+// pixels take to play.
+class StemCache {
+public:
+    explicit StemCache(std::string directory);
+
+    // Creates the directory if needed. False if it can't be used.
+    bool open();
+
+    // Adds the stem stored under key to audio. False, leaving audio alone, if
+    // there is none or it doesn't have numFrames frames.
+    bool addTo(uint64_t key, float* audio, int numFrames);
+    // Stores a stem under key. Failing to is not an error, the stem just
+    // has to be rendered again next time.
+    void store(uint64_t key, const float* audio, int numFrames);
+
+private:
+    std::string m_directory;
+
+    std::string getPath(uint64_t key);
+};
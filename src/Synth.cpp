@@ -1,151 +1,1136 @@
+#include <chrono>
 #include <cmath>
 #include <random>
+#include "HalfBandUpsampler.hpp"
+#include "PhaseDistortion.hpp"
 #include "Synth.hpp"
 
 
+// Number of lit rows above which SynthEngine::Auto switches to the inverse
+// FFT, and below which it switches back.
+constexpr int k_inverseFFTThreshold = 32;
+constexpr int k_oscillatorThreshold = 24;
+// Longest block rendered in one go. Longer requests are split up so the
+// cross-fade buffers can be allocated up front.
+constexpr int k_maxBlockSize = 4096;
+// Fewest groups of k_laneWidth partials worth handing to another thread.
+// Below this, waking a worker costs about as much as it saves.
+constexpr int k_minGroupsPerPartition = 4;
+// Realtime culling starts when the load passes this fraction of the CPU
+// budget, and then sheds partials until it expects to be at k_cullTarget.
+// Partials come back once the load is under k_uncullThreshold.
+constexpr float k_cullThreshold = 0.9;
+constexpr float k_cullTarget = 0.75;
+constexpr float k_uncullThreshold = 0.6;
+// Callbacks over which a culled partial fades out, or back in. The partial
+// limit is left alone for a little longer than that after each change, so
+// the load measured reflects it.
+constexpr int k_cullFadeCallbacks = 4;
+constexpr int k_cullHoldCallbacks = k_cullFadeCallbacks + 2;
+// Partials always rendered, however busy the machine.
+constexpr int k_minPartials = 16;
+// Fraction of the way the smoothed load falls towards each new measurement.
+// It rises immediately.
+constexpr float k_loadDecay = 0.05;
+
 float k_sineTable2048[2048] = {
 #include "sine_table_2048.txt"
 };
 
-float distortPhase(float phase, int mode, float distort)
+// Fixed-point phases: the top 11 bits select the table entry, the remaining 21
+// bits are the interpolation fraction.
+constexpr int k_tableBits = 11;
+constexpr int k_fractionBits = 32 - k_tableBits;
+constexpr uint32_t k_fractionMask = (1u << k_fractionBits) - 1;
+constexpr float k_fractionScale = 1.0f / (1u << k_fractionBits);
+constexpr double k_fixedPointOne = 4294967296.0;
+constexpr double k_pi = 3.14159265358979323846;
+// Samples between corrections of each phasor's magnitude.
+constexpr int k_renormalizeInterval = 16;
+constexpr int k_rotationSearchUlps = 3;
+// A partial goes in the deepest band whose sample rate is at least five times
+// its frequency, which is what HalfBandUpsampler passes cleanly.
+constexpr float k_maxBandIncrement = 0.2;
+// Blocks must divide evenly between the samples of the deepest band.
+constexpr int k_bandBlockMultiple = 1 << (k_numBands - 1);
+// Full-rate samples rendered, and discarded, to fill the upsamplers' history
+// when bands are switched on. Enough for the deepest band's filter to fill up
+// and its output to reach every shallower one.
+constexpr int k_primeLength = 2 * HalfBandUpsampler::k_numTaps * k_bandBlockMultiple;
+
+OscillatorBank::OscillatorBank(float sampleRate, int size)
+    : m_sampleRate(sampleRate)
+    , m_size(size)
+    , m_silentIndex(size)
+    , m_phases(size + 1)
+    , m_increments(size + 1)
+    , m_fixedPhases(size + 1)
+    , m_fixedIncrements(size + 1)
+    , m_amplitudesLeft(size + 1)
+    , m_targetAmplitudesLeft(size + 1)
+    , m_amplitudesRight(size + 1)
+    , m_targetAmplitudesRight(size + 1)
+    , m_wavetableOffsets(size + 1)
+    , m_rotationsReal(size + 1)
+    , m_rotationsImag(size + 1)
+    , m_bandRotationsReal(size + 1)
+    , m_bandRotationsImag(size + 1)
+    , m_bands(size + 1, 0)
+    , m_phaseFrames(size, 0)
+    , m_active(size)
+    , m_isActive(size, false)
+    , m_groups(size / k_laneWidth + k_numBands + 1)
+    , m_bandLeft(k_maxBlockSize)
+    , m_bandRight(k_maxBlockSize)
+    , m_fullRateLeft(k_maxBlockSize)
+    , m_fullRateRight(k_maxBlockSize)
+    , m_primeLeft(2 * k_primeLength)
+    , m_primeRight(2 * k_primeLength)
 {
-    switch (mode) {
-    case 0: // Pulsar
-        return std::min(phase * (1 + 6 * distort * distort), 1.f);
-    case 1: // Saw
-        {
-            float breakpoint = 0.25 * (1 - distort * 0.9);
-            float outerSlope = 0.25 / breakpoint;
-            float innerSlope = 0.5 / (1 - breakpoint * 2);
-            if (phase < breakpoint) {
-                return phase * outerSlope;
-            } else if (phase >= 1 - breakpoint) {
-                return 1 - (1 - phase) * outerSlope;
-            } else {
-                return 0.5 + (phase - 0.5) * innerSlope;
+    // Upsampler l - 1 takes band l to the rate of band l - 1.
+    for (int band = 1; band < k_numBands; band++) {
+        m_upsamplersLeft.emplace_back(k_maxBlockSize >> band);
+        m_upsamplersRight.emplace_back(k_maxBlockSize >> band);
+    }
+    // The deepest band sets the latency, so it isn't delayed.
+    for (int band = 0; band < k_numBands - 1; band++) {
+        int size = getAlignmentDelay(band) + (k_maxBlockSize >> band);
+        m_delaysLeft.emplace_back(size);
+        m_delaysRight.emplace_back(size);
+    }
+}
+
+static uint32_t toFixedPoint(double phase)
+{
+    return static_cast<uint32_t>(static_cast<uint64_t>(
+        std::llround(phase * k_fixedPointOne)
+    ));
+}
+
+void OscillatorBank::setFrequency(int index, float frequency)
+{
+    m_increments[index] = frequency / m_sampleRate;
+    m_fixedIncrements[index] = toFixedPoint(
+        static_cast<double>(frequency) / m_sampleRate
+    );
+    m_wavetableOffsets[index] = wavetableLevel(m_increments[index]) * k_wavetableStride;
+    int band = 0;
+    while (band + 1 < k_numBands && m_increments[index] * (2 << band) < k_maxBandIncrement) {
+        band++;
+    }
+    m_bands[index] = band;
+    double angle = 2 * k_pi * frequency / m_sampleRate;
+    findRotation(angle, m_rotationsReal[index], m_rotationsImag[index]);
+    findRotation(
+        angle * (1 << band), m_bandRotationsReal[index], m_bandRotationsImag[index]
+    );
+}
+
+// Error a float rotation makes over a typical block: the angle error adds up
+// sample after sample, the magnitude error only until the next correction.
+static double getRotationError(float real, float imag, double angle)
+{
+    double angleError = std::atan2(static_cast<double>(imag), static_cast<double>(real)) - angle;
+    double magnitudeError = std::hypot(static_cast<double>(real), static_cast<double>(imag)) - 1;
+    return 256 * std::abs(angleError) + k_renormalizeInterval * std::abs(magnitudeError);
+}
+
+void OscillatorBank::findRotation(double angle, float& rotationReal, float& rotationImag)
+{
+    // Rounding cos and sin to float separately leaves the rotation's angle
+    // off by up to an ulp of the cosine, enough to add up audibly in
+    // pitch-sensitive material over a block. Search the neighboring floats
+    // for a better pair.
+    float bestReal = std::cos(angle);
+    float bestImag = std::sin(angle);
+    double bestError = getRotationError(bestReal, bestImag, angle);
+    float real = bestReal;
+    for (int i = 0; i < k_rotationSearchUlps; i++) {
+        real = std::nextafter(real, -2.0f);
+    }
+    for (int i = 0; i <= 2 * k_rotationSearchUlps; i++) {
+        float imag = std::sin(angle);
+        for (int j = 0; j < k_rotationSearchUlps; j++) {
+            imag = std::nextafter(imag, -2.0f);
+        }
+        for (int j = 0; j <= 2 * k_rotationSearchUlps; j++) {
+            double error = getRotationError(real, imag, angle);
+            if (error < bestError) {
+                bestError = error;
+                bestReal = real;
+                bestImag = imag;
             }
+            imag = std::nextafter(imag, 2.0f);
         }
-    case 2: // Square
-        {
-            float cosinePhase = std::fmod(phase + 0.25f, 1.0f);
-
-            float adjustedDistort = distort * 0.9;
-            float breakpoint = adjustedDistort * 0.5;
-            float slope = 1 / (1 - adjustedDistort);
-
-            if (cosinePhase < breakpoint) {
-                cosinePhase = 0;
-            } else if (cosinePhase < 0.5f) {
-                cosinePhase = (cosinePhase - breakpoint) * slope;
-            } else if (cosinePhase < 0.5f + breakpoint) {
-                cosinePhase = 0.5;
-            } else {
-                cosinePhase = 0.5 + (cosinePhase - (0.5 + breakpoint)) * slope;
+        real = std::nextafter(real, 2.0f);
+    }
+    rotationReal = bestReal;
+    rotationImag = bestImag;
+}
+
+void OscillatorBank::setPhase(int index, float phase)
+{
+    m_phases[index] = phase;
+    m_fixedPhases[index] = toFixedPoint(phase);
+    m_phaseFrames[index] = m_frame;
+}
+
+void OscillatorBank::setPhaseMode(PhaseMode phaseMode)
+{
+    if (phaseMode == m_phaseMode) {
+        return;
+    }
+    // Carry the running phases over so switching modes doesn't click.
+    for (int i = 0; i < m_size; i++) {
+        if (phaseMode == PhaseMode::FixedPoint) {
+            m_fixedPhases[i] = toFixedPoint(m_phases[i]);
+        } else {
+            m_phases[i] = std::fmod(m_fixedPhases[i] / k_fixedPointOne, 1.0);
+        }
+    }
+    m_phaseMode = phaseMode;
+}
+
+void OscillatorBank::setTargetAmplitude(
+    int index, float amplitudeLeft, float amplitudeRight
+)
+{
+    m_targetAmplitudesLeft[index] = amplitudeLeft;
+    m_targetAmplitudesRight[index] = amplitudeRight;
+    if ((amplitudeLeft != 0 || amplitudeRight != 0) && !m_isActive[index]) {
+        activate(index);
+    }
+}
+
+void OscillatorBank::activate(int index)
+{
+    catchUpPhase(index);
+    m_isActive[index] = true;
+    m_active[m_numActive] = index;
+    if (m_numActive > 0 && m_active[m_numActive - 1] > index) {
+        m_activeSorted = false;
+    }
+    m_numActive++;
+}
+
+void OscillatorBank::catchUpPhase(int index)
+{
+    int64_t elapsed = m_frame - m_phaseFrames[index];
+    if (elapsed == 0) {
+        return;
+    }
+    advancePhase(index, elapsed);
+    m_phaseFrames[index] = m_frame;
+}
+
+void OscillatorBank::advancePhase(int index, int64_t numSamples)
+{
+    if (m_phaseMode == PhaseMode::FixedPoint) {
+        // Exact: the product wraps around modulo 2^32 just like the phase.
+        m_fixedPhases[index] += m_fixedIncrements[index] * static_cast<uint32_t>(numSamples);
+    } else {
+        m_phases[index] = std::fmod(
+            m_phases[index] + static_cast<double>(m_increments[index]) * numSamples, 1.0
+        );
+    }
+}
+
+void OscillatorBank::processAdd(float* out1, float* out2, int blockSize)
+{
+    if (!m_activeSorted) {
+        std::sort(m_active.begin(), m_active.begin() + m_numActive);
+        m_activeSorted = true;
+    }
+
+    const float* wavetables = nullptr;
+    if (
+        m_pdDistort != 0
+        && m_wavetables != nullptr
+        && m_wavetables->pdMode == m_pdMode
+        && m_wavetables->pdDistortStep == quantizePDDistort(m_pdDistort)
+    ) {
+        wavetables = m_wavetables->samples.data();
+    }
+
+    const bool useBands = usesBands(blockSize);
+    buildGroups(useBands);
+    if (!useBands) {
+        m_bandsPrimed = false;
+    } else if (!m_bandsPrimed) {
+        primeBands();
+    }
+    int bandsSize = useBands ? blockSize - (blockSize >> (k_numBands - 1)) : 0;
+    for (int i = 0; i < bandsSize; i++) {
+        m_bandLeft[i] = 0;
+        m_bandRight[i] = 0;
+    }
+    // The full rate is delayed along with the bands, so it can't be added to
+    // the output as it is rendered.
+    float* fullRateLeft = out1;
+    float* fullRateRight = out2;
+    if (useBands) {
+        fullRateLeft = m_fullRateLeft.data();
+        fullRateRight = m_fullRateRight.data();
+        for (int i = 0; i < blockSize; i++) {
+            fullRateLeft[i] = 0;
+            fullRateRight[i] = 0;
+        }
+    }
+    BandOutputs outputs = getBandOutputs(
+        fullRateLeft, fullRateRight, m_bandLeft.data(), m_bandRight.data(), blockSize
+    );
+    // Every phase starts ahead by the delay it will go through.
+    const int64_t phaseOffset = useBands ? k_bandLatency : 0;
+
+    int numPartitions = 1;
+    if (m_workerPool != nullptr && blockSize <= k_maxBlockSize) {
+        numPartitions = std::max(1, std::min(
+            m_workerPool->size() + 1, m_numGroups / k_minGroupsPerPartition
+        ));
+    }
+
+    if (numPartitions == 1) {
+        renderGroups(0, m_numGroups, wavetables, outputs, blockSize, phaseOffset);
+    } else {
+        m_job.wavetables = wavetables;
+        m_job.outputs = outputs;
+        m_job.blockSize = blockSize;
+        m_job.bandsSize = bandsSize;
+        m_job.phaseOffset = phaseOffset;
+        m_job.numPartitions = numPartitions;
+        m_workerPool->run(&OscillatorBank::renderPartition, this, numPartitions);
+        // Reduce in a fixed order so the result doesn't depend on which
+        // thread finished first.
+        for (int partition = 1; partition < numPartitions; partition++) {
+            const float* left = m_partitionLeft[partition - 1].data();
+            const float* right = m_partitionRight[partition - 1].data();
+            for (int i = 0; i < blockSize; i++) {
+                fullRateLeft[i] += left[i];
+                fullRateRight[i] += right[i];
             }
+            for (int i = 0; i < bandsSize; i++) {
+                m_bandLeft[i] += left[blockSize + i];
+                m_bandRight[i] += right[blockSize + i];
+            }
+        }
+    }
 
-            return std::fmod(cosinePhase - 0.25f + 1.0f, 1.0f);
+    if (useBands) {
+        delayBands(outputs, blockSize);
+        upsampleBands(outputs, blockSize);
+        for (int i = 0; i < blockSize; i++) {
+            out1[i] += fullRateLeft[i];
+            out2[i] += fullRateRight[i];
         }
-    case 3: // PWM
-        {
-            float adjustedDistort = distort * 0.9;
-            float breakpoint = 0.5 + 0.5 * adjustedDistort;
+    }
 
-            if (phase < breakpoint) {
-                return phase * 0.5 / breakpoint;
-            } else {
-                return 0.5 + (phase - breakpoint) * 0.5 / (1 - breakpoint);
+    m_frame += blockSize;
+    removeSilent();
+}
+
+void OscillatorBank::setWorkerPool(WorkerPool* pool)
+{
+    m_workerPool = pool;
+    int numBuffers = pool == nullptr ? 0 : pool->size();
+    m_partitionLeft.clear();
+    m_partitionRight.clear();
+    // Room for the full-rate output followed by every band.
+    for (int i = 0; i < numBuffers; i++) {
+        m_partitionLeft.emplace_back(2 * k_maxBlockSize);
+        m_partitionRight.emplace_back(2 * k_maxBlockSize);
+    }
+}
+
+void OscillatorBank::renderPartition(void* context, int partition)
+{
+    OscillatorBank& bank = *static_cast<OscillatorBank*>(context);
+    const auto& job = bank.m_job;
+    int firstGroup = bank.m_numGroups * partition / job.numPartitions;
+    int lastGroup = bank.m_numGroups * (partition + 1) / job.numPartitions;
+    if (partition == 0) {
+        bank.renderGroups(
+            firstGroup, lastGroup, job.wavetables, job.outputs, job.blockSize, job.phaseOffset
+        );
+        return;
+    }
+    float* left = bank.m_partitionLeft[partition - 1].data();
+    float* right = bank.m_partitionRight[partition - 1].data();
+    for (int i = 0; i < job.blockSize + job.bandsSize; i++) {
+        left[i] = 0;
+        right[i] = 0;
+    }
+    BandOutputs outputs = getBandOutputs(
+        left, right, left + job.blockSize, right + job.blockSize, job.blockSize
+    );
+    bank.renderGroups(
+        firstGroup, lastGroup, job.wavetables, outputs, job.blockSize, job.phaseOffset
+    );
+}
+
+OscillatorBank::BandOutputs OscillatorBank::getBandOutputs(
+    float* left, float* right, float* bandsLeft, float* bandsRight, int blockSize
+)
+{
+    // Bands are stored one after another, each half as long as the last.
+    BandOutputs outputs;
+    outputs.left[0] = left;
+    outputs.right[0] = right;
+    for (int band = 1; band < k_numBands; band++) {
+        int offset = blockSize - (blockSize >> (band - 1));
+        outputs.left[band] = bandsLeft + offset;
+        outputs.right[band] = bandsRight + offset;
+    }
+    return outputs;
+}
+
+void OscillatorBank::buildGroups(bool useBands)
+{
+    // m_active is sorted, and bands only get deeper towards lower rows, so
+    // each band is one contiguous run. Groups don't straddle runs.
+    m_numGroups = 0;
+    int offset = 0;
+    while (offset < m_numActive) {
+        int band = useBands ? m_bands[m_active[offset]] : 0;
+        int count = 1;
+        while (
+            count < k_laneWidth
+            && offset + count < m_numActive
+            && (useBands ? m_bands[m_active[offset + count]] : 0) == band
+        ) {
+            count++;
+        }
+        m_groups[m_numGroups] = { offset, count, band };
+        m_numGroups++;
+        offset += count;
+    }
+}
+
+void OscillatorBank::getGroupIndices(const Group& group, int* indices)
+{
+    for (int lane = 0; lane < k_laneWidth; lane++) {
+        indices[lane] = (
+            lane < group.count ? m_active[group.offset + lane] : m_silentIndex
+        );
+    }
+}
+
+bool OscillatorBank::isGroupSteady(const int* indices)
+{
+    for (int lane = 0; lane < k_laneWidth; lane++) {
+        int index = indices[lane];
+        if (
+            m_amplitudesLeft[index] != m_targetAmplitudesLeft[index]
+            || m_amplitudesRight[index] != m_targetAmplitudesRight[index]
+        ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void OscillatorBank::renderGroups(
+    int firstGroup,
+    int lastGroup,
+    const float* wavetables,
+    const BandOutputs& outputs,
+    int blockSize,
+    int64_t phaseOffset
+)
+{
+    // Undistorted sines don't need the table at all.
+    const bool useRotation = m_rotationEnabled && m_pdDistort == 0;
+    const GroupRenderer renderRamp = getGroupRenderer(m_phaseMode, m_pdMode, false);
+    const GroupRenderer renderSteady = getGroupRenderer(m_phaseMode, m_pdMode, true);
+    for (int group = firstGroup; group < lastGroup; group++) {
+        int indices[k_laneWidth];
+        getGroupIndices(m_groups[group], indices);
+        int band = m_groups[group].band;
+        bool steady = isGroupSteady(indices);
+        if (useRotation) {
+            auto renderRotation = (
+                steady
+                ? &OscillatorBank::processGroupRotation<true>
+                : &OscillatorBank::processGroupRotation<false>
+            );
+            (this->*renderRotation)(
+                indices,
+                band,
+                outputs.left[band],
+                outputs.right[band],
+                blockSize >> band,
+                phaseOffset
+            );
+            // Several groups may be padded with the silent partial, possibly
+            // on different threads, so leave it alone.
+            for (int lane = 0; lane < m_groups[group].count; lane++) {
+                advancePhase(indices[lane], blockSize);
             }
+        } else {
+            GroupRenderer renderGroup = steady ? renderSteady : renderRamp;
+            (this->*renderGroup)(indices, wavetables, outputs.left[0], outputs.right[0], blockSize);
         }
     }
-    return phase;
 }
 
-Oscillator::Oscillator(float sampleRate, float frequency, float phase)
-    : m_sampleRate(sampleRate)
-    , m_frequency(frequency)
-    , m_phase(phase)
+// Delays numSamples samples by delay, through a buffer holding the last delay
+// samples followed by room for numSamples more.
+static void delaySamples(float* samples, float* history, int delay, int numSamples)
 {
+    std::copy(samples, samples + numSamples, history + delay);
+    std::copy(history, history + numSamples, samples);
+    std::copy(history + numSamples, history + numSamples + delay, history);
 }
 
-void Oscillator::processAdd(float* out1, float* out2, int blockSize) {
-    for (int i = 0; i < blockSize; i++) {
-        m_phase = std::fmod(m_phase + m_frequency / m_sampleRate, 1.0);
-        float distortedPhase = std::fmod(distortPhase(m_phase, m_pdMode, m_pdDistort), 1.0);
-        int integerPhase = distortedPhase * 2048;
-        float frac = distortedPhase * 2048 - integerPhase;
-        int integerPhase2 = (integerPhase + 1) % 2048;
-        float amplitudeLeft = (
-            m_amplitudeLeft * (1 - i / static_cast<float>(blockSize))
-            + m_targetAmplitudeLeft * i / static_cast<float>(blockSize)
+void OscillatorBank::delayBands(const BandOutputs& outputs, int blockSize)
+{
+    for (int band = 0; band < k_numBands - 1; band++) {
+        int delay = getAlignmentDelay(band);
+        delaySamples(outputs.left[band], m_delaysLeft[band].data(), delay, blockSize >> band);
+        delaySamples(outputs.right[band], m_delaysRight[band].data(), delay, blockSize >> band);
+    }
+}
+
+void OscillatorBank::upsampleBands(const BandOutputs& outputs, int blockSize)
+{
+    // Deepest first, so each band carries all deeper ones along.
+    for (int band = k_numBands - 1; band > 0; band--) {
+        m_upsamplersLeft[band - 1].processAdd(
+            outputs.left[band], blockSize >> band, outputs.left[band - 1]
         );
-        float amplitudeRight = (
-            m_amplitudeRight * (1 - i / static_cast<float>(blockSize))
-            + m_targetAmplitudeRight * i / static_cast<float>(blockSize)
+        m_upsamplersRight[band - 1].processAdd(
+            outputs.right[band], blockSize >> band, outputs.right[band - 1]
         );
-        float outSample = (
-            k_sineTable2048[integerPhase] * (1 - frac)
-            + k_sineTable2048[integerPhase2] * frac
+    }
+}
+
+void OscillatorBank::primeBands()
+{
+    // Render the last k_primeLength samples as if the current amplitudes had
+    // held all along, so the delays and upsamplers pick up where a steady
+    // signal would have left them rather than starting from silence.
+    for (int band = 1; band < k_numBands; band++) {
+        m_upsamplersLeft[band - 1].reset();
+        m_upsamplersRight[band - 1].reset();
+    }
+    for (int band = 0; band < k_numBands - 1; band++) {
+        for (int i = 0; i < getAlignmentDelay(band); i++) {
+            m_delaysLeft[band][i] = 0;
+            m_delaysRight[band][i] = 0;
+        }
+    }
+    for (int i = 0; i < 2 * k_primeLength; i++) {
+        m_primeLeft[i] = 0;
+        m_primeRight[i] = 0;
+    }
+    BandOutputs outputs = getBandOutputs(
+        m_primeLeft.data(),
+        m_primeRight.data(),
+        m_primeLeft.data() + k_primeLength,
+        m_primeRight.data() + k_primeLength,
+        k_primeLength
+    );
+    for (int group = 0; group < m_numGroups; group++) {
+        int band = m_groups[group].band;
+        int indices[k_laneWidth];
+        getGroupIndices(m_groups[group], indices);
+        processGroupRotation<true>(
+            indices,
+            band,
+            outputs.left[band],
+            outputs.right[band],
+            k_primeLength >> band,
+            k_bandLatency - k_primeLength
         );
-        out1[i] += outSample * amplitudeLeft;
-        out2[i] += outSample * amplitudeRight;
     }
-    m_amplitudeLeft = m_targetAmplitudeLeft;
-    m_amplitudeRight = m_targetAmplitudeRight;
+    delayBands(outputs, k_primeLength);
+    upsampleBands(outputs, k_primeLength);
+    m_bandsPrimed = true;
 }
 
-Synth::Synth(float sampleRate, std::mt19937& randomEngine)
+OscillatorBank::GroupRenderer OscillatorBank::getGroupRenderer(
+    PhaseMode phaseMode, int pdMode, bool holdAmplitudes
+)
+{
+    static const GroupRenderer renderers[2][2][k_numPDModes] = {
+        {
+            {
+                &OscillatorBank::processGroup<PhaseMode::Float, 0, false>,
+                &OscillatorBank::processGroup<PhaseMode::Float, 1, false>,
+                &OscillatorBank::processGroup<PhaseMode::Float, 2, false>,
+                &OscillatorBank::processGroup<PhaseMode::Float, 3, false>,
+            },
+            {
+                &OscillatorBank::processGroup<PhaseMode::FixedPoint, 0, false>,
+                &OscillatorBank::processGroup<PhaseMode::FixedPoint, 1, false>,
+                &OscillatorBank::processGroup<PhaseMode::FixedPoint, 2, false>,
+                &OscillatorBank::processGroup<PhaseMode::FixedPoint, 3, false>,
+            },
+        },
+        {
+            {
+                &OscillatorBank::processGroup<PhaseMode::Float, 0, true>,
+                &OscillatorBank::processGroup<PhaseMode::Float, 1, true>,
+                &OscillatorBank::processGroup<PhaseMode::Float, 2, true>,
+                &OscillatorBank::processGroup<PhaseMode::Float, 3, true>,
+            },
+            {
+                &OscillatorBank::processGroup<PhaseMode::FixedPoint, 0, true>,
+                &OscillatorBank::processGroup<PhaseMode::FixedPoint, 1, true>,
+                &OscillatorBank::processGroup<PhaseMode::FixedPoint, 2, true>,
+                &OscillatorBank::processGroup<PhaseMode::FixedPoint, 3, true>,
+            },
+        },
+    };
+    return renderers[holdAmplitudes][phaseMode == PhaseMode::FixedPoint][pdMode];
+}
+
+void OscillatorBank::advance(int64_t numSamples)
+{
+    // The upsamplers' history is stale once rendering resumes.
+    m_bandsPrimed = false;
+    advanceActive(numSamples);
+    m_frame += numSamples;
+    removeSilent();
+}
+
+void OscillatorBank::skip(int64_t numBlocks, int blockSize)
+{
+    m_bandsPrimed = false;
+    if (m_phaseMode == PhaseMode::FixedPoint) {
+        // Exact however it's done.
+        advanceActive(numBlocks * blockSize);
+    } else if (m_rotationEnabled && m_pdDistort == 0) {
+        // Rotation advances phases in closed form once per block.
+        for (int64_t block = 0; block < numBlocks; block++) {
+            advanceActive(blockSize);
+        }
+    } else {
+        // processGroup adds the increment every sample. Step all partials
+        // together so the loop vectorizes.
+        std::vector<float> phases(m_numActive);
+        std::vector<float> increments(m_numActive);
+        for (int k = 0; k < m_numActive; k++) {
+            phases[k] = m_phases[m_active[k]];
+            increments[k] = m_increments[m_active[k]];
+        }
+        for (int64_t i = 0; i < numBlocks * blockSize; i++) {
+            for (int k = 0; k < m_numActive; k++) {
+                float newPhase = phases[k] + increments[k];
+                phases[k] = newPhase >= 1 ? newPhase - 1 : newPhase;
+            }
+        }
+        for (int k = 0; k < m_numActive; k++) {
+            m_phases[m_active[k]] = phases[k];
+        }
+    }
+    m_frame += numBlocks * blockSize;
+    removeSilent();
+}
+
+void OscillatorBank::advanceActive(int64_t numSamples)
+{
+    for (int k = 0; k < m_numActive; k++) {
+        advancePhase(m_active[k], numSamples);
+    }
+}
+
+void OscillatorBank::removeSilent()
+{
+    // Amplitude ramps are done, so current amplitudes are now the targets.
+    // Partials that reached silence leave the active set; compacting in place
+    // keeps it sorted.
+    int numActive = 0;
+    for (int k = 0; k < m_numActive; k++) {
+        int i = m_active[k];
+        m_amplitudesLeft[i] = m_targetAmplitudesLeft[i];
+        m_amplitudesRight[i] = m_targetAmplitudesRight[i];
+        if (m_amplitudesLeft[i] == 0 && m_amplitudesRight[i] == 0) {
+            m_isActive[i] = false;
+            m_phaseFrames[i] = m_frame;
+        } else {
+            m_active[numActive] = i;
+            numActive++;
+        }
+    }
+    m_numActive = numActive;
+}
+
+void OscillatorBank::getNextPhases(float* phases)
+{
+    for (int i = 0; i < m_size; i++) {
+        if (!m_isActive[i]) {
+            catchUpPhase(i);
+        }
+        if (m_phaseMode == PhaseMode::FixedPoint) {
+            phases[i] = static_cast<uint32_t>(m_fixedPhases[i] + m_fixedIncrements[i])
+                / k_fixedPointOne;
+        } else {
+            float phase = m_phases[i] + m_increments[i];
+            phases[i] = phase >= 1 ? phase - 1 : phase;
+        }
+    }
+}
+
+template <PhaseMode phaseMode, int pdMode, bool holdAmplitudes>
+void OscillatorBank::processGroup(
+    const int* indices,
+    const float* wavetables,
+    float* out1,
+    float* out2,
+    int blockSize
+)
+{
+    alignas(k_simdAlignment) float phase[k_laneWidth];
+    alignas(k_simdAlignment) float increment[k_laneWidth];
+    alignas(k_simdAlignment) uint32_t fixedPhase[k_laneWidth];
+    alignas(k_simdAlignment) uint32_t fixedIncrement[k_laneWidth];
+    alignas(k_simdAlignment) float amplitudeLeft[k_laneWidth];
+    alignas(k_simdAlignment) float targetAmplitudeLeft[k_laneWidth];
+    alignas(k_simdAlignment) float amplitudeRight[k_laneWidth];
+    alignas(k_simdAlignment) float targetAmplitudeRight[k_laneWidth];
+    alignas(k_simdAlignment) float sampleLeft[k_laneWidth];
+    alignas(k_simdAlignment) float sampleRight[k_laneWidth];
+    alignas(k_simdAlignment) int wavetableOffset[k_laneWidth];
+
+    for (int lane = 0; lane < k_laneWidth; lane++) {
+        phase[lane] = m_phases[indices[lane]];
+        increment[lane] = m_increments[indices[lane]];
+        fixedPhase[lane] = m_fixedPhases[indices[lane]];
+        fixedIncrement[lane] = m_fixedIncrements[indices[lane]];
+        amplitudeLeft[lane] = m_amplitudesLeft[indices[lane]];
+        targetAmplitudeLeft[lane] = m_targetAmplitudesLeft[indices[lane]];
+        amplitudeRight[lane] = m_amplitudesRight[indices[lane]];
+        targetAmplitudeRight[lane] = m_targetAmplitudesRight[indices[lane]];
+        wavetableOffset[lane] = m_wavetableOffsets[indices[lane]];
+    }
+
+    const float pdDistort = m_pdDistort;
+    // The wavetables are already distorted, and every PD mode is the identity
+    // at zero distortion.
+    const bool useWavetables = wavetables != nullptr;
+    const bool bypassDistortion = pdDistort == 0 || useWavetables;
+
+    for (int i = 0; i < blockSize; i++) {
+        for (int lane = 0; lane < k_laneWidth; lane++) {
+            int integerPhase;
+            float frac;
+            if (phaseMode == PhaseMode::FixedPoint) {
+                uint32_t newPhase = fixedPhase[lane] + fixedIncrement[lane];
+                fixedPhase[lane] = newPhase;
+                if (bypassDistortion) {
+                    integerPhase = newPhase >> k_fractionBits;
+                    frac = static_cast<int>(newPhase & k_fractionMask) * k_fractionScale;
+                } else {
+                    // Keep 24 bits so the conversion is exact and goes through
+                    // a signed int, which every SIMD instruction set has.
+                    float floatPhase = static_cast<int>(newPhase >> 8) * (1.0f / (1 << 24));
+                    float scaledPhase = distortPhase<pdMode>(floatPhase, pdDistort) * 2048;
+                    int truncatedPhase = scaledPhase;
+                    frac = scaledPhase - truncatedPhase;
+                    integerPhase = truncatedPhase & 2047;
+                }
+            } else {
+                // Phases stay in [0, 1) and increments below 1, so a
+                // conditional subtraction is the same as std::fmod(..., 1.0).
+                float newPhase = phase[lane] + increment[lane];
+                newPhase = newPhase >= 1 ? newPhase - 1 : newPhase;
+                phase[lane] = newPhase;
+                float distortedPhase = (
+                    bypassDistortion ? newPhase : distortPhase<pdMode>(newPhase, pdDistort)
+                );
+                distortedPhase = distortedPhase >= 1 ? distortedPhase - 1 : distortedPhase;
+                // Phases just below 1 can round up to 2048 here.
+                int truncatedPhase = distortedPhase * 2048;
+                frac = distortedPhase * 2048 - truncatedPhase;
+                integerPhase = truncatedPhase & 2047;
+            }
+            float ampLeft = amplitudeLeft[lane];
+            float ampRight = amplitudeRight[lane];
+            if (!holdAmplitudes) {
+                ampLeft = (
+                    amplitudeLeft[lane] * (1 - i / static_cast<float>(blockSize))
+                    + targetAmplitudeLeft[lane] * i / static_cast<float>(blockSize)
+                );
+                ampRight = (
+                    amplitudeRight[lane] * (1 - i / static_cast<float>(blockSize))
+                    + targetAmplitudeRight[lane] * i / static_cast<float>(blockSize)
+                );
+            }
+            float outSample;
+            if (useWavetables) {
+                const float* table = wavetables + wavetableOffset[lane];
+                outSample = table[integerPhase] * (1 - frac) + table[integerPhase + 1] * frac;
+            } else {
+                int integerPhase2 = (integerPhase + 1) & 2047;
+                outSample = (
+                    k_sineTable2048[integerPhase] * (1 - frac)
+                    + k_sineTable2048[integerPhase2] * frac
+                );
+            }
+            sampleLeft[lane] = outSample * ampLeft;
+            sampleRight[lane] = outSample * ampRight;
+        }
+        // Accumulate in partial order to keep the sum identical to the scalar
+        // oscillator-by-oscillator loop.
+        for (int lane = 0; lane < k_laneWidth; lane++) {
+            out1[i] += sampleLeft[lane];
+            out2[i] += sampleRight[lane];
+        }
+    }
+
+    // Several groups may be padded with the silent partial, possibly on
+    // different threads, so leave it alone.
+    for (int lane = 0; lane < k_laneWidth; lane++) {
+        if (indices[lane] == m_silentIndex) {
+            continue;
+        }
+        m_phases[indices[lane]] = phase[lane];
+        m_fixedPhases[indices[lane]] = fixedPhase[lane];
+    }
+}
+
+template <bool holdAmplitudes>
+void OscillatorBank::processGroupRotation(
+    const int* indices,
+    int band,
+    float* out1,
+    float* out2,
+    int numSamples,
+    int64_t phaseOffset
+)
+{
+    alignas(k_simdAlignment) float real[k_laneWidth];
+    alignas(k_simdAlignment) float imag[k_laneWidth];
+    alignas(k_simdAlignment) float rotationReal[k_laneWidth];
+    alignas(k_simdAlignment) float rotationImag[k_laneWidth];
+    alignas(k_simdAlignment) float amplitudeLeft[k_laneWidth];
+    alignas(k_simdAlignment) float targetAmplitudeLeft[k_laneWidth];
+    alignas(k_simdAlignment) float amplitudeRight[k_laneWidth];
+    alignas(k_simdAlignment) float targetAmplitudeRight[k_laneWidth];
+    alignas(k_simdAlignment) float sampleLeft[k_laneWidth];
+    alignas(k_simdAlignment) float sampleRight[k_laneWidth];
+
+    // Start each phasor at the phase of the block's first sample. Deriving
+    // it from the stored phase every block keeps rounding errors in the
+    // rotation from building up in amplitude or pitch.
+    const int64_t startOffset = 1 + phaseOffset;
+    const float* rotationsReal = band == 0 ? m_rotationsReal.data() : m_bandRotationsReal.data();
+    const float* rotationsImag = band == 0 ? m_rotationsImag.data() : m_bandRotationsImag.data();
+    for (int lane = 0; lane < k_laneWidth; lane++) {
+        int index = indices[lane];
+        double phase;
+        if (m_phaseMode == PhaseMode::FixedPoint) {
+            phase = static_cast<uint32_t>(
+                m_fixedPhases[index]
+                + m_fixedIncrements[index] * static_cast<uint32_t>(startOffset)
+            ) / k_fixedPointOne;
+        } else {
+            phase = m_phases[index] + static_cast<double>(m_increments[index]) * startOffset;
+        }
+        real[lane] = std::cos(2 * k_pi * phase);
+        imag[lane] = std::sin(2 * k_pi * phase);
+        rotationReal[lane] = rotationsReal[index];
+        rotationImag[lane] = rotationsImag[index];
+        amplitudeLeft[lane] = m_amplitudesLeft[index];
+        amplitudeRight[lane] = m_amplitudesRight[index];
+        targetAmplitudeLeft[lane] = m_targetAmplitudesLeft[index];
+        targetAmplitudeRight[lane] = m_targetAmplitudesRight[index];
+    }
+
+    for (int i = 0; i < numSamples; i++) {
+        for (int lane = 0; lane < k_laneWidth; lane++) {
+            float ampLeft = amplitudeLeft[lane];
+            float ampRight = amplitudeRight[lane];
+            if (!holdAmplitudes) {
+                ampLeft = (
+                    amplitudeLeft[lane] * (1 - i / static_cast<float>(numSamples))
+                    + targetAmplitudeLeft[lane] * i / static_cast<float>(numSamples)
+                );
+                ampRight = (
+                    amplitudeRight[lane] * (1 - i / static_cast<float>(numSamples))
+                    + targetAmplitudeRight[lane] * i / static_cast<float>(numSamples)
+                );
+            }
+            sampleLeft[lane] = imag[lane] * ampLeft;
+            sampleRight[lane] = imag[lane] * ampRight;
+            float newReal = real[lane] * rotationReal[lane] - imag[lane] * rotationImag[lane];
+            imag[lane] = real[lane] * rotationImag[lane] + imag[lane] * rotationReal[lane];
+            real[lane] = newReal;
+        }
+        for (int lane = 0; lane < k_laneWidth; lane++) {
+            out1[i] += sampleLeft[lane];
+            out2[i] += sampleRight[lane];
+        }
+        if ((i + 1) % k_renormalizeInterval == 0) {
+            // One Newton step towards unit magnitude.
+            for (int lane = 0; lane < k_laneWidth; lane++) {
+                float gain = 1.5f - 0.5f * (real[lane] * real[lane] + imag[lane] * imag[lane]);
+                real[lane] *= gain;
+                imag[lane] *= gain;
+            }
+        }
+    }
+}
+
+int64_t OscillatorBank::getBandDelay(int band)
+{
+    // Each upsampler delays by k_delay samples at its output rate.
+    return static_cast<int64_t>(HalfBandUpsampler::k_delay) * ((1 << band) - 1);
+}
+
+int OscillatorBank::getAlignmentDelay(int band)
+{
+    return static_cast<int>((k_bandLatency - getBandDelay(band)) >> band);
+}
+
+bool OscillatorBank::usesBands(int blockSize)
+{
+    // Pure sines can be rendered at reduced rates, if the block divides
+    // evenly between them.
+    return (
+        m_multirateEnabled
+        && m_rotationEnabled
+        && m_pdDistort == 0
+        && blockSize % k_bandBlockMultiple == 0
+        && blockSize <= k_maxBlockSize
+    );
+}
+
+Synth::Synth(float sampleRate, const Tuning& tuning, std::mt19937& randomEngine)
+    : Synth(sampleRate, tuning, randomPhases(tuning.size(), randomEngine))
+{
+}
+
+Synth::Synth(float sampleRate, const Tuning& tuning, const std::vector<float>& phases)
     : m_sampleRate(sampleRate)
+    , m_bank(sampleRate, tuning.size())
+    , m_inverseFFT(sampleRate, tuning.size())
+    , m_phaseScratch(tuning.size())
+    , m_crossfadeLeft(k_maxBlockSize)
+    , m_crossfadeRight(k_maxBlockSize)
+    , m_requestedLeft(tuning.size())
+    , m_requestedRight(tuning.size())
+    , m_cullGains(tuning.size(), 1)
+    , m_cullTargets(tuning.size())
+    , m_cullOrder(tuning.size())
+    , m_partialLimit(tuning.size())
+{
+    setOscillators(tuning, phases);
+}
+
+std::vector<float> Synth::randomPhases(int numOscillators, std::mt19937& randomEngine)
 {
     std::uniform_real_distribution<> distribution;
-    for (int i = 0; i < 239; i++) {
-        float frequency = 55.0 / 2 * std::pow(2, i / 24.0);
-        float phase = distribution(randomEngine);
-        m_oscillators.push_back(
-            std::make_unique<Oscillator>(m_sampleRate, frequency, phase)
-        );
+    std::vector<float> phases(numOscillators);
+    for (auto& phase : phases) {
+        phase = distribution(randomEngine);
     }
+    return phases;
 }
 
-void Synth::setPDMode(int pdMode)
+void Synth::setOscillators(const Tuning& tuning, const std::vector<float>& phases)
+{
+    for (int i = 0; i < m_bank.size(); i++) {
+        m_bank.setFrequency(i, tuning[i]);
+        m_bank.setPhase(i, phases[i]);
+        m_inverseFFT.setIncrement(i, m_bank.getIncrement(i));
+    }
+}
+
+void Synth::restart(const Tuning& tuning, const std::vector<float>& phases)
+{
+    for (int i = 0; i < m_bank.size(); i++) {
+        m_requestedLeft[i] = 0;
+        m_requestedRight[i] = 0;
+        setOscillatorAmplitude(i, 0, 0);
+    }
+    // Jumps to the silent targets without moving time on.
+    m_bank.advance(0);
+    setOscillators(tuning, phases);
+}
+
+void Synth::skip(int64_t numBlocks, int blockSize)
 {
-    for (int i = 0; i < m_oscillators.size(); i++) {
-        m_oscillators[i]->setPDMode(pdMode);
+    m_bank.skip(numBlocks, blockSize);
+}
+
+void Synth::setNumThreads(int numThreads)
+{
+    // Detach the bank before its current pool goes away.
+    m_bank.setWorkerPool(nullptr);
+    m_workerPool.reset();
+    if (numThreads > 1) {
+        m_workerPool = std::make_unique<WorkerPool>(numThreads - 1);
+        m_bank.setWorkerPool(m_workerPool.get());
     }
 }
 
+void Synth::setPDMode(int pdMode)
+{
+    m_pdMode = pdMode;
+    m_bank.setPDMode(pdMode);
+    requestWavetables();
+}
+
 void Synth::setPDDistort(float pdDistort)
 {
-    for (int i = 0; i < m_oscillators.size(); i++) {
-        m_oscillators[i]->setPDDistort(pdDistort);
+    m_pdDistort = pdDistort;
+    m_bank.setPDDistort(pdDistort);
+    requestWavetables();
+}
+
+void Synth::requestWavetables()
+{
+    // Without distortion every partial reads the plain sine table.
+    if (m_pdDistort != 0) {
+        m_wavetables.request(m_pdMode, m_pdDistort);
     }
 }
 
+void Synth::setPhaseMode(PhaseMode phaseMode)
+{
+    m_bank.setPhaseMode(phaseMode);
+}
+
+void Synth::setRotationEnabled(bool enabled)
+{
+    m_bank.setRotationEnabled(enabled);
+}
+
+void Synth::setMultirateEnabled(bool enabled)
+{
+    m_bank.setMultirateEnabled(enabled);
+}
+
 void Synth::setOscillatorAmplitude(int index, float amplitudeLeft, float amplitudeRight)
 {
-    m_oscillators[index]->setTargetAmplitudeLeft(amplitudeLeft);
-    m_oscillators[index]->setTargetAmplitudeRight(amplitudeRight);
+    m_bank.setTargetAmplitude(index, amplitudeLeft, amplitudeRight);
+    m_inverseFFT.setTargetAmplitude(index, amplitudeLeft, amplitudeRight);
 }
 
 void Synth::updateFromRingBuffer(std::shared_ptr<RingBuffer<float>> ringBuffer)
 {
-    int count = ringBuffer->read();
-    if (count == 0) {
-        return;
-    }
+    int messageSize = message::getSize(m_bank.size());
     auto buffer = ringBuffer->getOutputBuffer();
-    setPDMode(buffer[0]);
-    setPDDistort(buffer[1]);
-    int amplitudeOffset = 2;
-    int numOscillators = std::min(
-        (count - amplitudeOffset) / 2, static_cast<int>(m_oscillators.size())
-    );
-    for (int i = 0; i < numOscillators; i++) {
+    while (true) {
+        // Messages are read one at a time, so the output buffer holds the
+        // pending one until it is due.
+        if (!m_hasPendingMessage) {
+            if (ringBuffer->getReadAvailable() < messageSize) {
+                return;
+            }
+            ringBuffer->read(messageSize);
+            m_hasPendingMessage = true;
+        }
+        if (message::getTime(buffer) > m_realtimeFrame) {
+            return;
+        }
+        m_hasPendingMessage = false;
+
+        setPDMode(buffer[0]);
+        setPDDistort(buffer[1]);
+        setEngine(static_cast<SynthEngine>(static_cast<int>(buffer[2])));
+        // Consecutive columns are often the same, and rows that didn't
+        // change already have the right targets.
+        const float* amplitudes = buffer + message::k_amplitudeOffset;
+        for (int i = 0; i < m_bank.size(); i++) {
+            if (
+                amplitudes[2 * i] == m_requestedLeft[i]
+                && amplitudes[2 * i + 1] == m_requestedRight[i]
+            ) {
+                continue;
+            }
+            m_requestedLeft[i] = amplitudes[2 * i];
+            m_requestedRight[i] = amplitudes[2 * i + 1];
+            setOscillatorAmplitude(
+                i, m_requestedLeft[i] * m_cullGains[i], m_requestedRight[i] * m_cullGains[i]
+            );
+        }
+    }
+}
+
+void Synth::cullPartials()
+{
+    int size = m_bank.size();
+    int numAudible = 0;
+    for (int i = 0; i < size; i++) {
+        m_cullTargets[i] = 1;
+        if (m_requestedLeft[i] != 0 || m_requestedRight[i] != 0) {
+            m_cullOrder[numAudible++] = i;
+        }
+    }
+
+    int numCulled = std::max(numAudible - m_partialLimit, 0);
+    if (numCulled > 0) {
+        // Rank by requested amplitude. Partials still playing count for up
+        // to twice as much, so two of similar loudness don't keep trading
+        // places.
+        auto score = [this](int i) {
+            return (m_requestedLeft[i] + m_requestedRight[i]) * (1 + m_cullGains[i]);
+        };
+        std::nth_element(
+            m_cullOrder.begin(),
+            m_cullOrder.begin() + m_partialLimit,
+            m_cullOrder.begin() + numAudible,
+            [&score](int a, int b) { return score(a) > score(b); }
+        );
+        for (int k = m_partialLimit; k < numAudible; k++) {
+            m_cullTargets[m_cullOrder[k]] = 0;
+        }
+    }
+    m_numCulled = numCulled;
+
+    // The bank ramps to the new amplitudes over each block, so stepping the
+    // gains once per callback fades linearly over k_cullFadeCallbacks.
+    float step = 1.0f / k_cullFadeCallbacks;
+    for (int i = 0; i < size; i++) {
+        float gain = m_cullGains[i];
+        if (gain == m_cullTargets[i]) {
+            continue;
+        }
+        if (gain < m_cullTargets[i]) {
+            gain = std::min(gain + step, 1.0f);
+        } else {
+            gain = std::max(gain - step, 0.0f);
+        }
+        m_cullGains[i] = gain;
         setOscillatorAmplitude(
-            i, buffer[amplitudeOffset + 2 * i], buffer[amplitudeOffset + 2 * i + 1]
+            i, m_requestedLeft[i] * gain, m_requestedRight[i] * gain
         );
     }
 }
 
+void Synth::updatePartialLimit(float load)
+{
+    // Rise at once so a slow callback is acted on, but fall slowly so one
+    // fast callback doesn't bring every partial back.
+    m_smoothedLoad = std::max(load, m_smoothedLoad + k_loadDecay * (load - m_smoothedLoad));
+    m_load = m_smoothedLoad;
+
+    int size = m_bank.size();
+    if (m_cpuBudget <= 0) {
+        m_partialLimit = size;
+        return;
+    }
+    if (m_cullHoldCallbacks > 0) {
+        m_cullHoldCallbacks--;
+        return;
+    }
+    if (m_smoothedLoad > k_cullThreshold * m_cpuBudget) {
+        // Assume the time spent is proportional to the partials rendered.
+        int numRendered = std::min(m_bank.getNumActive(), m_partialLimit);
+        int limit = numRendered * k_cullTarget * m_cpuBudget / m_smoothedLoad;
+        limit = std::max(limit, k_minPartials);
+        if (limit < m_partialLimit) {
+            m_partialLimit = limit;
+            m_cullHoldCallbacks = k_cullHoldCallbacks;
+        }
+    } else if (m_smoothedLoad < k_uncullThreshold * m_cpuBudget && m_partialLimit < size) {
+        m_partialLimit = std::min(m_partialLimit + std::max(m_partialLimit / 8, 1), size);
+        m_cullHoldCallbacks = k_cullHoldCallbacks;
+    }
+}
+
 void Synth::process(
     int output_channels,
     float** output_buffer,
@@ -160,17 +1145,115 @@ void Synth::process(
         output_buffer[0][j] = 0;
         output_buffer[1][j] = 0;
     }
-    for (auto& oscillator : m_oscillators) {
-        oscillator->processAdd(output_buffer[0], output_buffer[1], frame_count);
+    for (int offset = 0; offset < frame_count; offset += k_maxBlockSize) {
+        processBlock(
+            output_buffer[0] + offset,
+            output_buffer[1] + offset,
+            std::min(frame_count - offset, k_maxBlockSize)
+        );
+    }
+}
+
+bool Synth::shouldUseInverseFFT()
+{
+    switch (m_engine) {
+    case SynthEngine::Oscillators:
+        return false;
+    case SynthEngine::InverseFFT:
+        return true;
+    case SynthEngine::Auto:
+        break;
+    }
+    if (m_pdDistort != 0) {
+        return false;
+    }
+    int audible = m_bank.getNumActive();
+    if (m_usingInverseFFT) {
+        return audible >= k_oscillatorThreshold;
+    }
+    return audible >= k_inverseFFTThreshold;
+}
+
+int Synth::getLatency(int blockSize)
+{
+    if (shouldUseInverseFFT()) {
+        return InverseFFTSynth::getLatency(blockSize);
+    }
+    return m_bank.getLatency(blockSize);
+}
+
+void Synth::renderEngine(bool inverseFFT, float* out1, float* out2, int blockSize)
+{
+    if (inverseFFT) {
+        m_inverseFFT.processAdd(out1, out2, blockSize);
+    } else {
+        m_bank.processAdd(out1, out2, blockSize);
     }
 }
 
+void Synth::processBlock(float* out1, float* out2, int blockSize)
+{
+    m_bank.setWavetables(m_wavetables.acquire());
+    bool useInverseFFT = shouldUseInverseFFT();
+
+    if (useInverseFFT == m_usingInverseFFT) {
+        renderEngine(useInverseFFT, out1, out2, blockSize);
+        if (useInverseFFT) {
+            // Keep the idle bank in phase for when it takes over again.
+            m_bank.advance(blockSize);
+        }
+        return;
+    }
+
+    // Switching engines: render both and cross-fade over this block. Both
+    // start from the same phases, so the fade is seamless.
+    if (useInverseFFT) {
+        m_bank.getNextPhases(m_phaseScratch.data());
+        m_inverseFFT.reset(m_phaseScratch.data());
+    }
+    for (int i = 0; i < blockSize; i++) {
+        m_crossfadeLeft[i] = 0;
+        m_crossfadeRight[i] = 0;
+    }
+    renderEngine(m_usingInverseFFT, m_crossfadeLeft.data(), m_crossfadeRight.data(), blockSize);
+    renderEngine(useInverseFFT, out1, out2, blockSize);
+    for (int i = 0; i < blockSize; i++) {
+        float fadeIn = (i + 1) / static_cast<float>(blockSize);
+        out1[i] = out1[i] * fadeIn + m_crossfadeLeft[i] * (1 - fadeIn);
+        out2[i] = out2[i] * fadeIn + m_crossfadeRight[i] * (1 - fadeIn);
+    }
+    m_usingInverseFFT = useInverseFFT;
+}
+
 void Synth::processRealtime(
     int outputChannels,
     float** outputBuffer,
     int frameCount,
     std::shared_ptr<RingBuffer<float>> ringBuffer
 ) {
+    auto start = std::chrono::steady_clock::now();
     updateFromRingBuffer(ringBuffer);
-    process(outputChannels, outputBuffer, frameCount);
+    cullPartials();
+
+    int offset = 0;
+    while (offset < frameCount) {
+        // Render up to when the pending message is due, rounded up so the
+        // octave bands stay in use.
+        int length = frameCount - offset;
+        if (m_hasPendingMessage) {
+            int64_t untilDue = message::getTime(ringBuffer->getOutputBuffer()) - m_realtimeFrame;
+            untilDue = (untilDue + k_bandBlockMultiple - 1) / k_bandBlockMultiple * k_bandBlockMultiple;
+            length = std::min<int64_t>(length, untilDue);
+        }
+        float* segment[2] = { outputBuffer[0] + offset, outputBuffer[1] + offset };
+        process(outputChannels, segment, length);
+        offset += length;
+        m_realtimeFrame += length;
+        updateFromRingBuffer(ringBuffer);
+    }
+
+    if (frameCount > 0) {
+        std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start;
+        updatePartialLimit(elapsed.count() * m_sampleRate / frameCount);
+    }
 }
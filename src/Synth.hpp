@@ -1,45 +1,400 @@
 #pragma once
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstdint>
 #include <memory>
 #include <random>
 #include <vector>
+#include "AlignedBuffer.hpp"
+#include "HalfBandUpsampler.hpp"
+#include "InverseFFTSynth.hpp"
 #include "RingBuffer.hpp"
+#include "Tuning.hpp"
+#include "Wavetables.hpp"
+#include "WorkerPool.hpp"
 
 
-class Oscillator {
+// Number of partials the oscillator bank renders side by side. Every per-lane
+// loop in OscillatorBank is written so that the compiler can turn it into a
+// single SIMD instruction: 16 floats fill an AVX-512 register, 8 fill an AVX2
+// register or two SSE2/NEON registers.
+#if defined(__AVX512F__)
+constexpr int k_laneWidth = 16;
+#else
+constexpr int k_laneWidth = 8;
+#endif
+
+// Number of sample rates OscillatorBank renders pure sines at: the full rate
+// and four successive halvings.
+constexpr int k_numBands = 5;
+// Frames by which the octave bands delay amplitude changes: the delay of the
+// deepest band's upsamplers. Shallower bands are delayed to match.
+constexpr int k_bandLatency = HalfBandUpsampler::k_delay * ((1 << (k_numBands - 1)) - 1);
+
+// Frames to render after Synth::skip before the output matches rendering all
+// along. Skipping leaves the multirate bands' upsamplers without their real
+// history, and each one refills it from k_numTaps samples of the band below,
+// deepest first: 16 * (16 + 8 + 4 + 2) frames. The delays that line the
+// shallower bands up with the deepest hold less history than that.
+constexpr int k_skipSettleFrames = (
+    HalfBandUpsampler::k_numTaps * ((2 << (k_numBands - 1)) - 2)
+);
+
+// How oscillator phases are stored and advanced.
+enum class PhaseMode {
+    // Float phase in [0, 1), wrapped by subtracting 1.
+    Float,
+    // Unsigned 32-bit fixed point covering one cycle. Wraparound is free and
+    // exact, and the top 11 bits index the 2048-point sine table directly.
+    FixedPoint
+};
+
+// Structure-of-arrays bank of sine oscillators with phase distortion. State for
+// all partials lives in contiguous aligned arrays and is processed
+// k_laneWidth partials at a time.
+//
+// With phase distortion off, each partial is a complex phasor rotated by a
+// fixed per-sample multiplier, which needs no table lookups. The phasor is
+// recomputed from the stored phase at the start of every block and its
+// magnitude is corrected every few samples, which keeps it within about
+// -110 dB of an exact sine at usual block sizes, on par with the table.
+//
+// Pure sines are also rendered at the lowest sample rate that holds them:
+// partials are grouped into octave bands at successively halved rates, and
+// each band is upsampled into the next with a half-band filter. Low partials
+// in the deepest band cost a sixteenth of a full-rate one. Each shallower band
+// is delayed to line up with the deepest, and every band's phases start ahead
+// by the total delay, so partials stay in phase with full-rate rendering.
+// Amplitude changes in every band arrive k_bandLatency samples (5 ms at
+// 48 kHz) late; see getLatency.
+//
+// With phase distortion on, partials read band-limited wavetables matching
+// their pitch when tables for the current mode and distortion are available,
+// and distort the sine table's phase directly otherwise.
+//
+// Only active partials are rendered: those whose current or target amplitude
+// is nonzero. The active set is kept up to date by setTargetAmplitude and
+// processAdd. Silent partials cost nothing; their phase is brought up to date
+// in closed form when they become active again. Groups of partials that are
+// all at their target amplitudes skip the per-sample amplitude ramps.
+//
+// Samples are summed into the output in partial order, so the result is
+// bit-identical to rendering the partials one after another with scalar code
+// (given the same floating-point flags; FMA contraction changes the last bit),
+// except for the rounding of phases that were advanced in closed form.
+//
+// Given a WorkerPool, large blocks are split into contiguous runs of active
+// partials, one per thread. Each run is summed into its own buffer and the
+// buffers are added up in partition order, so the output only depends on the
+// number of threads, not on their timing. It differs from single-threaded
+// output in the last bits.
+class OscillatorBank {
 public:
-    Oscillator(float sampleRate, float frequency, float phase);
-    void processAdd(float* out1, float* out2, int blockSize);
-    void setTargetAmplitudeLeft(float amplitude) { m_targetAmplitudeLeft = amplitude; };
-    void setTargetAmplitudeRight(float amplitude) { m_targetAmplitudeRight = amplitude; };
+    OscillatorBank(float sampleRate, int size);
 
+    int size() { return m_size; };
+
+    void setFrequency(int index, float frequency);
+    void setPhase(int index, float phase);
+    void setPhaseMode(PhaseMode phaseMode);
+    // Whether undistorted partials use phasor rotation (the default) or the
+    // sine table. The table is only worth it for comparison.
+    void setRotationEnabled(bool enabled) { m_rotationEnabled = enabled; };
+    // Whether pure sines are rendered in octave bands at reduced sample rates
+    // (the default) or all at the full rate.
+    void setMultirateEnabled(bool enabled) { m_multirateEnabled = enabled; };
+    void setTargetAmplitude(int index, float amplitudeLeft, float amplitudeRight);
+
+    float getIncrement(int index) { return m_increments[index]; };
+    // Frames by which amplitude changes reach the output late with blocks of
+    // blockSize: k_bandLatency while pure sines are rendered in bands, 0
+    // otherwise.
+    int getLatency(int blockSize) { return usesBands(blockSize) ? k_bandLatency : 0; };
+    // Phase, in cycles, that each partial will use for its next sample.
+    void getNextPhases(float* phases);
+    int getNumActive() { return m_numActive; };
+
+    // pdMode must be in [0, k_numPDModes).
     void setPDMode(int pdMode) { m_pdMode = pdMode; };
     void setPDDistort(float pdDistort) { m_pdDistort = pdDistort; };
+    // Tables to render distorted partials with, or nullptr. Ignored unless
+    // they match the current PD mode and distortion.
+    void setWavetables(const WavetableSet* wavetables) { m_wavetables = wavetables; };
+
+    // Renders with the pool's workers as well as the calling thread, or
+    // single-threaded if pool is nullptr. Allocates, so call it off the audio
+    // thread. The pool must outlive the bank or be replaced first.
+    void setWorkerPool(WorkerPool* pool);
+
+    void processAdd(float* out1, float* out2, int blockSize);
+    // Moves phases forward as if numSamples samples had been rendered, and
+    // jumps to the target amplitudes.
+    void advance(int64_t numSamples);
+    // Like advance, but moves phases in the same steps processAdd would, so
+    // that rendering after a skip rounds them the same as rendering all along.
+    void skip(int64_t numBlocks, int blockSize);
 
 private:
     const float m_sampleRate;
-    float m_phase = 0;
-    const float m_frequency;
-    float m_amplitudeLeft = 0.0;
-    float m_targetAmplitudeLeft = 0.0;
-    float m_amplitudeRight = 0.0;
-    float m_targetAmplitudeRight = 0.0;
+    const int m_size;
+    // Index of an extra, always silent partial that fills unused lanes.
+    const int m_silentIndex;
+
+    PhaseMode m_phaseMode = PhaseMode::Float;
+    AlignedBuffer<float> m_phases;
+    AlignedBuffer<float> m_increments;
+    AlignedBuffer<uint32_t> m_fixedPhases;
+    AlignedBuffer<uint32_t> m_fixedIncrements;
+    AlignedBuffer<float> m_amplitudesLeft;
+    AlignedBuffer<float> m_targetAmplitudesLeft;
+    AlignedBuffer<float> m_amplitudesRight;
+    AlignedBuffer<float> m_targetAmplitudesRight;
+    // Start of each partial's mip level within a WavetableSet.
+    AlignedBuffer<int> m_wavetableOffsets;
+    // Per-sample rotation of each partial's phasor, cos and sin of its
+    // angular increment.
+    AlignedBuffer<float> m_rotationsReal;
+    AlignedBuffer<float> m_rotationsImag;
+    bool m_rotationEnabled = true;
+    // The same, per sample of the partial's band.
+    AlignedBuffer<float> m_bandRotationsReal;
+    AlignedBuffer<float> m_bandRotationsImag;
+
+    // Band each partial is rendered in when bands are in use: its sample
+    // rate is the full rate divided by 2^band.
+    std::vector<int> m_bands;
+    bool m_multirateEnabled = true;
+    // False until the upsamplers' history matches the partials again, after
+    // bands were last out of use.
+    bool m_bandsPrimed = false;
+
+    // Sample count since construction, and the sample count at which each
+    // inactive partial's phase was last brought up to date.
+    int64_t m_frame = 0;
+    std::vector<int64_t> m_phaseFrames;
+
+    // Indices of active partials. Kept sorted so the output is summed in
+    // partial order; m_activeSorted is false after an append.
+    std::vector<int> m_active;
+    std::vector<bool> m_isActive;
+    int m_numActive = 0;
+    bool m_activeSorted = true;
+
+    // Up to k_laneWidth active partials from one band, starting at
+    // m_active[offset]. Rebuilt every block.
+    struct Group {
+        int offset;
+        int count;
+        int band;
+    };
+    std::vector<Group> m_groups;
+    int m_numGroups = 0;
+
+    // Where samples of each band go, at the band's sample rate.
+    struct BandOutputs {
+        float* left[k_numBands];
+        float* right[k_numBands];
+    };
+    // Bands other than the full rate, one after another.
+    AlignedBuffer<float> m_bandLeft;
+    AlignedBuffer<float> m_bandRight;
+    // The full rate, while bands are in use, since it is delayed before it
+    // reaches the caller's buffers.
+    AlignedBuffer<float> m_fullRateLeft;
+    AlignedBuffer<float> m_fullRateRight;
+    // m_delaysLeft[band] holds the last samples of band, which is delayed to
+    // line up with the deepest band, followed by room for a block.
+    std::vector<AlignedBuffer<float>> m_delaysLeft;
+    std::vector<AlignedBuffer<float>> m_delaysRight;
+    // m_upsamplersLeft[band - 1] takes band to the rate of band - 1.
+    std::vector<HalfBandUpsampler> m_upsamplersLeft;
+    std::vector<HalfBandUpsampler> m_upsamplersRight;
+    // Output of primeBands, which is thrown away.
+    AlignedBuffer<float> m_primeLeft;
+    AlignedBuffer<float> m_primeRight;
 
     int m_pdMode = 0;
     float m_pdDistort = 0;
+    const WavetableSet* m_wavetables = nullptr;
+
+    WorkerPool* m_workerPool = nullptr;
+    // Output of every partition except the first, which renders straight
+    // into the caller's buffers: the full-rate output followed by the bands.
+    std::vector<AlignedBuffer<float>> m_partitionLeft;
+    std::vector<AlignedBuffer<float>> m_partitionRight;
+    // Arguments of the processAdd call being split across threads.
+    struct {
+        const float* wavetables;
+        BandOutputs outputs;
+        int blockSize;
+        int bandsSize;
+        int64_t phaseOffset;
+        int numPartitions;
+    } m_job;
+
+    void activate(int index);
+    void catchUpPhase(int index);
+    void advancePhase(int index, int64_t numSamples);
+    static void findRotation(double angle, float& rotationReal, float& rotationImag);
+    void advanceActive(int64_t numSamples);
+    void removeSilent();
+
+    static BandOutputs getBandOutputs(
+        float* left, float* right, float* bandsLeft, float* bandsRight, int blockSize
+    );
+    static int64_t getBandDelay(int band);
+    // Samples of band, at its own rate, it is delayed by to line up with the
+    // deepest band.
+    static int getAlignmentDelay(int band);
+    bool usesBands(int blockSize);
+    void buildGroups(bool useBands);
+    void getGroupIndices(const Group& group, int* indices);
+    // Whether every partial in the group is already at its target amplitude,
+    // so the group can be rendered without amplitude ramps.
+    bool isGroupSteady(const int* indices);
+    void renderGroups(
+        int firstGroup,
+        int lastGroup,
+        const float* wavetables,
+        const BandOutputs& outputs,
+        int blockSize,
+        int64_t phaseOffset
+    );
+    static void renderPartition(void* context, int partition);
+    void delayBands(const BandOutputs& outputs, int blockSize);
+    void upsampleBands(const BandOutputs& outputs, int blockSize);
+    void primeBands();
+
+    // Renders one group of k_laneWidth partials. Instantiated for every phase
+    // mode and PD mode, and picked with getGroupRenderer, so the per-sample
+    // loop has no mode switches. With holdAmplitudes, the partials play at
+    // their current amplitudes throughout, skipping the ramps to the targets.
+    template <PhaseMode phaseMode, int pdMode, bool holdAmplitudes>
+    void processGroup(
+        const int* indices,
+        const float* wavetables,
+        float* out1,
+        float* out2,
+        int blockSize
+    );
+    // Renders numSamples samples at the band's rate, starting phaseOffset
+    // full-rate samples after the current phases, without advancing them.
+    template <bool holdAmplitudes>
+    void processGroupRotation(
+        const int* indices,
+        int band,
+        float* out1,
+        float* out2,
+        int numSamples,
+        int64_t phaseOffset
+    );
+
+    using GroupRenderer = void (OscillatorBank::*)(
+        const int* indices,
+        const float* wavetables,
+        float* out1,
+        float* out2,
+        int blockSize
+    );
+    static GroupRenderer getGroupRenderer(PhaseMode phaseMode, int pdMode, bool holdAmplitudes);
 };
 
+// Which algorithm Synth renders with.
+enum class SynthEngine {
+    // Time-domain OscillatorBank. Supports phase distortion.
+    Oscillators,
+    // InverseFFTSynth. Costs about the same for any number of lit rows, but
+    // ignores phase distortion.
+    InverseFFT,
+    // InverseFFT when many rows are lit and phase distortion is off,
+    // Oscillators otherwise.
+    Auto
+};
+
+// Layout of the messages processRealtime reads from the ring buffer: the PD
+// mode, distortion, and engine, the frame of realtime output from which they
+// apply, and then two amplitudes per row. The frame is split across two
+// floats so it stays exact.
+namespace message {
+
+constexpr int k_timeOffset = 3;
+constexpr int k_amplitudeOffset = 5;
+
+inline int getSize(int numRows)
+{
+    return k_amplitudeOffset + 2 * numRows;
+}
+
+inline void setTime(float* message, int64_t frame)
+{
+    message[k_timeOffset] = frame >> 24;
+    message[k_timeOffset + 1] = frame & 0xffffff;
+}
+
+inline int64_t getTime(const float* message)
+{
+    return (static_cast<int64_t>(message[k_timeOffset]) << 24)
+        + static_cast<int64_t>(message[k_timeOffset + 1]);
+}
+
+} // namespace message
+
 class Synth {
 public:
-    Synth(float sampleRate, std::mt19937& randomEngine);
+    // One partial per row of the tuning, at random phases.
+    Synth(float sampleRate, const Tuning& tuning, std::mt19937& randomEngine);
+    // The same, starting at the given phases, in cycles.
+    Synth(float sampleRate, const Tuning& tuning, const std::vector<float>& phases);
 
-    int getNumOscillators() { return m_oscillators.size(); };
+    // The phases the first constructor draws from randomEngine.
+    static std::vector<float> randomPhases(int numOscillators, std::mt19937& randomEngine);
+
+    // Silences the oscillators at once and retunes them, as if the synth had
+    // just been constructed with the same number of rows. Keeps the
+    // wavetables, so it is much cheaper than constructing another synth.
+    // The inverse FFT isn't restarted, so only use this with
+    // SynthEngine::Oscillators.
+    void restart(const Tuning& tuning, const std::vector<float>& phases);
+    // Moves time forward as if numBlocks blocks of blockSize frames had been
+    // rendered at the target amplitudes, without synthesizing them. The
+    // first k_skipSettleFrames rendered after it differ from rendering all
+    // along. Like restart, only for SynthEngine::Oscillators.
+    void skip(int64_t numBlocks, int blockSize);
+    // Frames by which the next block of blockSize frames will play amplitude
+    // changes late. Offline renders set amplitudes this far ahead to make up
+    // for it; realtime playback can't.
+    int getLatency(int blockSize);
+
+    int getNumOscillators() { return m_bank.size(); };
 
     void setPDMode(int pdMode);
     void setPDDistort(float pdDistort);
+    void setPhaseMode(PhaseMode phaseMode);
+    // See OscillatorBank::setRotationEnabled and setMultirateEnabled.
+    void setRotationEnabled(bool enabled);
+    void setMultirateEnabled(bool enabled);
+    void setEngine(SynthEngine engine) { m_engine = engine; };
+    // Number of threads the oscillator bank renders on, counting the caller.
+    // Starts at 1. Spawns threads, so call it off the audio thread.
+    void setNumThreads(int numThreads);
     void setOscillatorAmplitude(int index, float amplitudeLeft, float amplitudeRight);
+    // Time processRealtime may spend per callback, as a fraction of the audio
+    // the callback renders. As the measured time nears it, only the loudest
+    // partials are rendered and the rest fade out. 0, the default, never
+    // culls.
+    void setCPUBudget(float budget) { m_cpuBudget = budget; };
+    // Smoothed time of recent realtime callbacks relative to the audio they
+    // rendered, and how many audible partials are culled. Safe to call from
+    // any thread.
+    float getLoad() { return m_load.load(); };
+    int getNumCulled() { return m_numCulled.load(); };
+    // Blocks until wavetables for the current PD settings are ready. Offline
+    // renders call this so they never fall back to unfiltered distortion.
+    void waitForWavetables() { m_wavetables.waitForRequest(); };
 
+    // Applies the messages in the ring buffer that are due by the current
+    // realtime frame, in order. A message that isn't due yet stays pending.
     void updateFromRingBuffer(std::shared_ptr<RingBuffer<float>>);
 
     void process(
@@ -48,6 +403,8 @@ public:
         int frame_count
     );
 
+    // Renders the next frame_count frames of realtime output, splitting the
+    // block where pending messages come due.
     void processRealtime(
         int output_channels,
         float** output_buffer,
@@ -58,7 +415,45 @@ public:
 private:
     const float m_sampleRate;
     std::unique_ptr<uint32_t[]> m_pixels;
-    std::vector<std::unique_ptr<Oscillator>> m_oscillators;
+    std::unique_ptr<WorkerPool> m_workerPool;
+    OscillatorBank m_bank;
+    InverseFFTSynth m_inverseFFT;
     float m_position = 0;
     float m_speedInPixelsPerSecond = 100;
+
+    int m_pdMode = 0;
+    float m_pdDistort = 0;
+    WavetableBuilder m_wavetables;
+    SynthEngine m_engine = SynthEngine::Oscillators;
+    bool m_usingInverseFFT = false;
+    AlignedBuffer<float> m_phaseScratch;
+    AlignedBuffer<float> m_crossfadeLeft;
+    AlignedBuffer<float> m_crossfadeRight;
+
+    // Frames of realtime output so far, the clock messages are timed by, and
+    // whether the ring buffer's output buffer holds a message not yet due.
+    int64_t m_realtimeFrame = 0;
+    bool m_hasPendingMessage = false;
+
+    // Realtime culling. Amplitudes from the ring buffer are kept as requested
+    // and sent on scaled by each partial's cull gain.
+    float m_cpuBudget = 0;
+    std::vector<float> m_requestedLeft;
+    std::vector<float> m_requestedRight;
+    std::vector<float> m_cullGains;
+    std::vector<float> m_cullTargets;
+    std::vector<int> m_cullOrder;
+    int m_partialLimit;
+    int m_cullHoldCallbacks = 0;
+    float m_smoothedLoad = 0;
+    std::atomic<float> m_load { 0 };
+    std::atomic<int> m_numCulled { 0 };
+
+    void setOscillators(const Tuning& tuning, const std::vector<float>& phases);
+    void requestWavetables();
+    void cullPartials();
+    void updatePartialLimit(float load);
+    bool shouldUseInverseFFT();
+    void renderEngine(bool inverseFFT, float* out1, float* out2, int blockSize);
+    void processBlock(float* out1, float* out2, int blockSize);
 };
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "common.hpp"
+#include "Tuning.hpp"
+
+namespace tuning {
+
+// Enough for several rows per cent over the audible range.
+constexpr int k_maxNumRows = 16384;
+
+Tuning equalDivision(int numRows, float lowestFrequency, float divisionsPerOctave)
+{
+    Tuning tuning(numRows);
+    for (int i = 0; i < numRows; i++) {
+        tuning[i] = lowestFrequency * std::pow(2, i / static_cast<double>(divisionsPerOctave));
+    }
+    return tuning;
+}
+
+Tuning logRange(int numRows, float lowestFrequency, float highestFrequency)
+{
+    if (numRows == 1) {
+        return Tuning { lowestFrequency };
+    }
+    Tuning tuning(numRows);
+    double octaves = std::log2(static_cast<double>(highestFrequency) / lowestFrequency);
+    for (int i = 0; i < numRows; i++) {
+        tuning[i] = lowestFrequency * std::pow(2, octaves * i / (numRows - 1));
+    }
+    return tuning;
+}
+
+Tuning defaultTuning()
+{
+    return equalDivision(
+        k_defaultNumRows, k_defaultLowestFrequency, k_defaultDivisionsPerOctave
+    );
+}
+
+static bool parseFrequencies(
+    const std::vector<std::string>& strings, std::vector<float>& frequencies
+)
+{
+    for (auto& string : strings) {
+        try {
+            frequencies.push_back(std::stof(trim(string)));
+        } catch (std::invalid_argument& e) {
+            return false;
+        } catch (std::out_of_range& e) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::tuple<bool, std::string> parse(
+    const std::string& description, int numRows, Tuning& tuning
+)
+{
+    auto colon = description.find(':');
+    if (colon == std::string::npos) {
+        return std::make_tuple(false, "Tuning must look like edo:24, range:20:20000, or hz:110,220");
+    }
+    std::string kind = description.substr(0, colon);
+    std::vector<float> numbers;
+    if (!parseFrequencies(split(description.substr(colon + 1), kind == "hz" ? ',' : ':'), numbers)) {
+        return std::make_tuple(false, "Invalid number in tuning '" + description + "'");
+    }
+    for (float number : numbers) {
+        if (!(number > 0)) {
+            return std::make_tuple(false, "Tuning values must be positive");
+        }
+    }
+
+    Tuning result;
+    if (kind == "hz") {
+        if (numbers.empty()) {
+            return std::make_tuple(false, "Tuning hz: needs at least one frequency");
+        }
+        for (int i = 1; i < static_cast<int>(numbers.size()); i++) {
+            if (numbers[i] <= numbers[i - 1]) {
+                return std::make_tuple(false, "Tuning frequencies must be increasing");
+            }
+        }
+        result = numbers;
+    } else {
+        if (numRows < 1) {
+            return std::make_tuple(false, "Number of rows must be at least 1");
+        }
+        if (kind == "edo") {
+            if (numbers.size() != 1 && numbers.size() != 2) {
+                return std::make_tuple(false, "Expected edo:DIVISIONS or edo:DIVISIONS:LOWEST_HZ");
+            }
+            float lowest = numbers.size() == 2 ? numbers[1] : k_defaultLowestFrequency;
+            result = equalDivision(numRows, lowest, numbers[0]);
+        } else if (kind == "range") {
+            if (numbers.size() != 2 || numbers[1] <= numbers[0]) {
+                return std::make_tuple(false, "Expected range:LOWEST_HZ:HIGHEST_HZ");
+            }
+            result = logRange(numRows, numbers[0], numbers[1]);
+        } else {
+            return std::make_tuple(false, "Unknown tuning kind '" + kind + "'");
+        }
+    }
+
+    if (static_cast<int>(result.size()) > k_maxNumRows) {
+        return std::make_tuple(
+            false, "At most " + std::to_string(k_maxNumRows) + " rows are supported"
+        );
+    }
+    tuning = result;
+    return std::make_tuple(true, "");
+}
+
+int findNearestRow(const Tuning& tuning, float frequency)
+{
+    int size = tuning.size();
+    int row = std::lower_bound(tuning.begin(), tuning.end(), frequency) - tuning.begin();
+    if (row == size || (row > 0 && frequency / tuning[row - 1] < tuning[row] / frequency)) {
+        row--;
+    }
+    // Distances are in octaves. Past either end, the outermost spacing is
+    // assumed to continue, so a frequency half a row or more beyond the end
+    // has no row. The margin makes exact halfway points count as too far
+    // despite rounding.
+    float distance = std::abs(std::log2(frequency / tuning[row]));
+    float maxDistance = 1 / 24.f;
+    if (size > 1 && frequency < tuning.front()) {
+        maxDistance = std::min(maxDistance, std::log2(tuning[1] / tuning[0]) / 2);
+    } else if (size > 1 && frequency > tuning.back()) {
+        maxDistance = std::min(
+            maxDistance, std::log2(tuning[size - 1] / tuning[size - 2]) / 2
+        );
+    }
+    if (distance >= 0.99f * maxDistance) {
+        return -1;
+    }
+    return row;
+}
+
+} // namespace tuning
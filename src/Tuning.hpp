@@ -0,0 +1,35 @@
+#pragma once
+#include <string>
+#include <tuple>
+#include <vector>
+
+// Frequency in Hz of every canvas row, from the bottom row up. Always strictly
+// increasing.
+using Tuning = std::vector<float>;
+
+namespace tuning {
+
+// 239 quarter tones starting at A0.
+constexpr int k_defaultNumRows = 239;
+constexpr float k_defaultLowestFrequency = 27.5;
+constexpr float k_defaultDivisionsPerOctave = 24;
+
+Tuning equalDivision(int numRows, float lowestFrequency, float divisionsPerOctave);
+Tuning logRange(int numRows, float lowestFrequency, float highestFrequency);
+Tuning defaultTuning();
+
+// Parses a tuning description:
+//   edo:DIVISIONS[:LOWEST_HZ]  numRows steps of DIVISIONS-EDO, from A0 by default
+//   range:LOWEST_HZ:HIGHEST_HZ numRows rows spaced evenly in pitch
+//   hz:F1,F2,...               one row per listed frequency; numRows is ignored
+// Returns success and an error message, like io::Status.
+std::tuple<bool, std::string> parse(
+    const std::string& description, int numRows, Tuning& tuning
+);
+
+// Row whose frequency is nearest to the given one in pitch, or -1 if that row
+// is a quarter tone or more away, or the frequency is half a row or more past
+// either end of the tuning.
+int findNearestRow(const Tuning& tuning, float frequency);
+
+} // namespace tuning
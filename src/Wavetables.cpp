@@ -0,0 +1,161 @@
+#include <algorithm>
+#include <cmath>
+
+#include "common.hpp"
+#include "PhaseDistortion.hpp"
+#include "Wavetables.hpp"
+
+// The distorted sine is sampled at four times the table resolution before
+// band-limiting, so the kinks of the distortion functions don't alias into the
+// harmonics that are kept.
+constexpr int k_sourceSize = 4 * k_wavetableSize;
+constexpr double k_pi = 3.14159265358979323846;
+
+int quantizePDDistort(float pdDistort)
+{
+    return std::lround(std::min(std::max(pdDistort, 0.f), 1.f) * k_pdDistortSteps);
+}
+
+int wavetableLevel(float increment)
+{
+    int level = 0;
+    while (
+        level < k_wavetableLevels - 1
+        && (k_wavetableSize / 2 >> level) * increment > 0.5f
+    ) {
+        level++;
+    }
+    return level;
+}
+
+WavetableBuilder::WavetableBuilder()
+    : m_middle(1)
+    , m_requestedKey(-1)
+{
+    for (auto& set : m_sets) {
+        set.samples.resize(k_wavetableLevels * k_wavetableStride);
+    }
+
+    // Planned here rather than on the builder thread, where the FFTW planner
+    // would need locking around every request. FFTW_ESTIMATE leaves the
+    // arrays untouched.
+    std::lock_guard<std::mutex> lock(getFFTWPlannerMutex());
+    m_source = fftwf_alloc_real(k_sourceSize);
+    m_spectrum = fftwf_alloc_complex(k_sourceSize / 2 + 1);
+    m_levelSpectrum = fftwf_alloc_complex(k_wavetableSize / 2 + 1);
+    m_levelSamples = fftwf_alloc_real(k_wavetableSize);
+    m_analysisPlan = fftwf_plan_dft_r2c_1d(
+        k_sourceSize, m_source, m_spectrum, FFTW_ESTIMATE
+    );
+    m_synthesisPlan = fftwf_plan_dft_c2r_1d(
+        k_wavetableSize, m_levelSpectrum, m_levelSamples, FFTW_ESTIMATE
+    );
+
+    m_thread = std::thread(&WavetableBuilder::run, this);
+}
+
+WavetableBuilder::~WavetableBuilder()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_requestSemaphore.post();
+    m_published.notify_all();
+    m_thread.join();
+
+    std::lock_guard<std::mutex> lock(getFFTWPlannerMutex());
+    fftwf_destroy_plan(m_analysisPlan);
+    fftwf_destroy_plan(m_synthesisPlan);
+    fftwf_free(m_source);
+    fftwf_free(m_spectrum);
+    fftwf_free(m_levelSpectrum);
+    fftwf_free(m_levelSamples);
+}
+
+void WavetableBuilder::request(int pdMode, float pdDistort)
+{
+    int key = pdMode * (k_pdDistortSteps + 1) + quantizePDDistort(pdDistort);
+    if (m_requestedKey.exchange(key) != key) {
+        m_requestSemaphore.post();
+    }
+}
+
+void WavetableBuilder::waitForRequest()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_published.wait(lock, [this] {
+        return m_stopping || m_publishedKey == m_requestedKey.load();
+    });
+}
+
+const WavetableSet* WavetableBuilder::acquire()
+{
+    if (m_middle.load() & k_freshFlag) {
+        m_frontIndex = m_middle.exchange(m_frontIndex) & k_indexMask;
+    }
+    const WavetableSet& set = m_sets[m_frontIndex];
+    return set.pdMode < 0 ? nullptr : &set;
+}
+
+void WavetableBuilder::run()
+{
+    while (true) {
+        // A request that changes the key again while a build is running
+        // leaves a post behind, so it is picked up on the next pass.
+        m_requestSemaphore.wait();
+        int key = m_requestedKey.load();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_stopping) {
+                return;
+            }
+            if (key == m_publishedKey) {
+                continue;
+            }
+        }
+
+        build(key, m_sets[m_backIndex]);
+        m_backIndex = m_middle.exchange(m_backIndex | k_freshFlag) & k_indexMask;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_publishedKey = key;
+        }
+        m_published.notify_all();
+    }
+}
+
+void WavetableBuilder::build(int key, WavetableSet& set)
+{
+    int pdMode = key / (k_pdDistortSteps + 1);
+    int pdDistortStep = key % (k_pdDistortSteps + 1);
+    float pdDistort = pdDistortStep / static_cast<float>(k_pdDistortSteps);
+
+    for (int i = 0; i < k_sourceSize; i++) {
+        float phase = distortPhase(static_cast<float>(i) / k_sourceSize, pdMode, pdDistort);
+        m_source[i] = std::sin(2 * k_pi * phase);
+    }
+    fftwf_execute(m_analysisPlan);
+
+    // Truncate the spectrum to each level's harmonics and resynthesize one
+    // cycle. FFTW's transforms are unnormalized, hence the division.
+    for (int level = 0; level < k_wavetableLevels; level++) {
+        int numHarmonics = std::min(k_wavetableSize / 2 >> level, k_wavetableSize / 2 - 1);
+        for (int bin = 0; bin <= k_wavetableSize / 2; bin++) {
+            bool keep = bin <= numHarmonics;
+            m_levelSpectrum[bin][0] = keep ? m_spectrum[bin][0] / k_sourceSize : 0;
+            m_levelSpectrum[bin][1] = keep ? m_spectrum[bin][1] / k_sourceSize : 0;
+        }
+        fftwf_execute(m_synthesisPlan);
+
+        float* table = set.samples.data() + level * k_wavetableStride;
+        for (int i = 0; i < k_wavetableSize; i++) {
+            table[i] = m_levelSamples[i];
+        }
+        table[k_wavetableSize] = table[0];
+    }
+
+    set.pdMode = pdMode;
+    set.pdDistortStep = pdDistortStep;
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <fftw3.h>
+
+#include "AlignedBuffer.hpp"
+#include "WorkerPool.hpp"
+
+// Distortion amounts are rounded to multiples of 1 / k_pdDistortSteps before
+// tables are built, so a slider drag triggers a bounded number of rebuilds.
+constexpr int k_pdDistortSteps = 256;
+constexpr int k_wavetableSize = 2048;
+// Level n keeps harmonics up to k_wavetableSize / 2 >> n, one level per
+// octave down to a pure sine.
+constexpr int k_wavetableLevels = 11;
+// Each table is followed by a copy of its first sample, so interpolation never
+// has to wrap around.
+constexpr int k_wavetableStride = k_wavetableSize + 1;
+
+int quantizePDDistort(float pdDistort);
+
+// Mip level a partial with this phase increment (in cycles per sample) must
+// read from so that none of its harmonics exceed the Nyquist frequency.
+int wavetableLevel(float increment);
+
+// One cycle of sin(2 pi distortPhase(p)) for one PD mode and distortion amount,
+// at every mip level, stored level after level.
+struct WavetableSet {
+    int pdMode = -1;
+    int pdDistortStep = -1;
+    AlignedBuffer<float> samples;
+};
+
+// Builds band-limited phase distortion wavetables on a background thread.
+//
+// Requests and the finished tables are exchanged without locks: the builder
+// and the audio thread each own one WavetableSet, and trade it for a third one
+// through a single atomic index (a triple buffer). Neither side ever waits for
+// the other, and the set returned by acquire() is never written while it is
+// in use.
+class WavetableBuilder {
+public:
+    WavetableBuilder();
+    ~WavetableBuilder();
+
+    WavetableBuilder(const WavetableBuilder&) = delete;
+    WavetableBuilder& operator=(const WavetableBuilder&) = delete;
+
+    // Asks for tables for this mode and distortion amount. Doesn't block or
+    // allocate, so it is safe to call from the audio thread.
+    void request(int pdMode, float pdDistort);
+    // Blocks until the tables for the latest request have been published.
+    void waitForRequest();
+    // Newest published tables, or nullptr if there are none yet. Only call
+    // from one thread; the set stays valid until the next call.
+    const WavetableSet* acquire();
+
+private:
+    static constexpr int k_indexMask = 3;
+    static constexpr int k_freshFlag = 4;
+
+    WavetableSet m_sets[3];
+    // Index of the set owned by acquire(), and of the set the builder writes.
+    int m_frontIndex = 0;
+    int m_backIndex = 2;
+    // Index of the set in between, plus k_freshFlag if it was published after
+    // the last acquire().
+    std::atomic<int> m_middle;
+
+    // Requests and published sets are identified by
+    // pdMode * (k_pdDistortSteps + 1) + pdDistortStep; -1 means none.
+    std::atomic<int> m_requestedKey;
+    int m_publishedKey = -1;
+    bool m_stopping = false;
+    // Posted by request() whenever the requested key changes, and on
+    // destruction.
+    Semaphore m_requestSemaphore;
+    std::mutex m_mutex;
+    std::condition_variable m_published;
+
+    float* m_source;
+    fftwf_complex* m_spectrum;
+    fftwf_complex* m_levelSpectrum;
+    float* m_levelSamples;
+    fftwf_plan m_analysisPlan;
+    fftwf_plan m_synthesisPlan;
+
+    std::thread m_thread;
+
+    void run();
+    void build(int key, WavetableSet& set);
+};
@@ -0,0 +1,210 @@
+#include <climits>
+
+#include "WorkerPool.hpp"
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+// Polls before a worker parks. A few hundred microseconds, so a worker stays
+// awake between the blocks of a busy audio callback but doesn't burn a core
+// when playback stops.
+constexpr int k_spinIterations = 4096;
+
+static void cpuRelax()
+{
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+#if defined(_WIN32)
+
+Semaphore::Semaphore()
+    : m_handle(CreateSemaphore(nullptr, 0, LONG_MAX, nullptr))
+{
+}
+
+Semaphore::~Semaphore()
+{
+    CloseHandle(m_handle);
+}
+
+void Semaphore::post()
+{
+    ReleaseSemaphore(m_handle, 1, nullptr);
+}
+
+void Semaphore::wait()
+{
+    WaitForSingleObject(m_handle, INFINITE);
+}
+
+#elif defined(__APPLE__)
+
+Semaphore::Semaphore()
+    : m_semaphore(dispatch_semaphore_create(0))
+{
+}
+
+Semaphore::~Semaphore()
+{
+    dispatch_release(m_semaphore);
+}
+
+void Semaphore::post()
+{
+    dispatch_semaphore_signal(m_semaphore);
+}
+
+void Semaphore::wait()
+{
+    dispatch_semaphore_wait(m_semaphore, DISPATCH_TIME_FOREVER);
+}
+
+#else
+
+Semaphore::Semaphore()
+{
+    sem_init(&m_semaphore, 0, 0);
+}
+
+Semaphore::~Semaphore()
+{
+    sem_destroy(&m_semaphore);
+}
+
+void Semaphore::post()
+{
+    sem_post(&m_semaphore);
+}
+
+void Semaphore::wait()
+{
+    // Retry if a signal interrupts the wait.
+    while (sem_wait(&m_semaphore) != 0) {
+    }
+}
+
+#endif
+
+// Pins a worker to one core, skipping core 0, which the OS tends to favor
+// for interrupts and the audio callback. Best effort: failures are ignored.
+static void pinToCore(std::thread& thread, int index)
+{
+    unsigned numCores = std::thread::hardware_concurrency();
+    if (numCores < 2) {
+        return;
+    }
+    unsigned core = 1 + index % (numCores - 1);
+#if defined(_WIN32)
+    SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << core);
+#elif defined(__linux__)
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(core, &cpuSet);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(cpuSet), &cpuSet);
+#else
+    // macOS only offers affinity hints, which don't pin.
+    (void)thread;
+    (void)core;
+#endif
+}
+
+WorkerPool::WorkerPool(int numWorkers, Mode mode)
+    : m_mode(mode)
+{
+    for (int i = 0; i < numWorkers; i++) {
+        m_workers.push_back(std::make_unique<Worker>());
+    }
+    for (int i = 0; i < numWorkers; i++) {
+        m_workers[i]->thread = std::thread(&WorkerPool::runWorker, this, i);
+        if (m_mode == Mode::Realtime) {
+            pinToCore(m_workers[i]->thread, i);
+        }
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    m_stopping = true;
+    for (auto& worker : m_workers) {
+        wake(*worker);
+    }
+    for (auto& worker : m_workers) {
+        worker->thread.join();
+    }
+}
+
+void WorkerPool::wake(Worker& worker)
+{
+    worker.generation++;
+    // Pairs with the worker storing sleeping and then rereading generation:
+    // either the worker sees the new generation or we see it sleeping.
+    if (worker.sleeping.load()) {
+        worker.semaphore.post();
+    }
+}
+
+void WorkerPool::run(Task task, void* context, int numTasks)
+{
+    m_task = task;
+    m_context = context;
+    m_pending = numTasks - 1;
+    for (int i = 0; i < numTasks - 1; i++) {
+        wake(*m_workers[i]);
+    }
+
+    task(context, 0);
+
+    if (m_mode == Mode::Offline) {
+        // The last worker posts exactly once, even if it is already done.
+        if (numTasks > 1) {
+            m_done.wait();
+        }
+        return;
+    }
+    while (m_pending.load() != 0) {
+        cpuRelax();
+    }
+}
+
+void WorkerPool::runWorker(int index)
+{
+    Worker& worker = *m_workers[index];
+    unsigned seenGeneration = 0;
+    int spinIterations = m_mode == Mode::Realtime ? k_spinIterations : 0;
+    while (true) {
+        int spins = 0;
+        while (worker.generation.load() == seenGeneration) {
+            if (spins < spinIterations) {
+                cpuRelax();
+                spins++;
+                continue;
+            }
+            worker.sleeping = true;
+            if (worker.generation.load() == seenGeneration) {
+                worker.semaphore.wait();
+            }
+            worker.sleeping = false;
+        }
+        seenGeneration = worker.generation.load();
+
+        if (m_stopping) {
+            return;
+        }
+        m_task(m_context, index + 1);
+        if (--m_pending == 0 && m_mode == Mode::Offline) {
+            m_done.post();
+        }
+    }
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#elif defined(__APPLE__)
+#include <dispatch/dispatch.h>
+#else
+#include <semaphore.h>
+#endif
+
+// Counting semaphore. post() doesn't block or take locks on any platform, so
+// the audio thread can use it to wake a parked worker.
+class Semaphore {
+public:
+    Semaphore();
+    ~Semaphore();
+
+    Semaphore(const Semaphore&) = delete;
+    Semaphore& operator=(const Semaphore&) = delete;
+
+    void post();
+    void wait();
+
+private:
+#if defined(_WIN32)
+    void* m_handle;
+#elif defined(__APPLE__)
+    dispatch_semaphore_t m_semaphore;
+#else
+    sem_t m_semaphore;
+#endif
+};
+
+// Fixed set of worker threads for splitting realtime work across cores.
+//
+// run() hands every worker the same task and returns once all of them are
+// done. Neither side allocates or takes a lock: workers are woken through a
+// per-worker generation counter, spin on it for a while, and only park on a
+// semaphore once they have been idle for longer than a short audio block.
+// Workers are pinned to their own cores where the platform allows it.
+//
+// Offline work, which isn't in a hurry and shares the machine with other
+// processes, should use Mode::Offline instead: workers aren't pinned and park
+// as soon as they are idle, and run() waits on a semaphore instead of
+// spinning.
+class WorkerPool {
+public:
+    using Task = void (*)(void* context, int taskIndex);
+
+    enum class Mode {
+        Realtime,
+        Offline
+    };
+
+    explicit WorkerPool(int numWorkers, Mode mode = Mode::Realtime);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    int size() { return m_workers.size(); }
+
+    // Calls task(context, i) for every i in [0, numTasks): task 0 on the
+    // calling thread, the others on workers. numTasks may be at most size() + 1.
+    void run(Task task, void* context, int numTasks);
+
+private:
+    struct Worker {
+        std::atomic<unsigned> generation { 0 };
+        std::atomic<bool> sleeping { false };
+        Semaphore semaphore;
+        std::thread thread;
+    };
+
+    // Each worker is allocated separately so that workers polling their own
+    // counters don't share cache lines.
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    const Mode m_mode;
+    std::atomic<bool> m_stopping { false };
+    std::atomic<int> m_pending { 0 };
+    // Posted by the last worker to finish, in offline mode.
+    Semaphore m_done;
+    Task m_task = nullptr;
+    void* m_context = nullptr;
+
+    void runWorker(int index);
+    void wake(Worker& worker);
+};
@@ -1,5 +1,10 @@
 #include "common.hpp"
 
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif // _WIN32
+
 std::string getHomeDirectory() {
 #ifdef _WIN32
     return std::string(std::getenv("HOMEDRIVE")) + std::getenv("HOMEPATH");
@@ -8,6 +13,21 @@ std::string getHomeDirectory() {
 #endif // _WIN32
 };
 
+void setBinaryMode(FILE* stream)
+{
+#ifdef _WIN32
+    _setmode(_fileno(stream), _O_BINARY);
+#else
+    (void)stream;
+#endif // _WIN32
+}
+
+std::mutex& getFFTWPlannerMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
 std::string getPathSeparator() {
 #ifdef _WIN32
     return "\\";
@@ -1,6 +1,8 @@
 #pragma once
 #include <algorithm>
+#include <cstdio>
 #include <cstdlib>
+#include <mutex>
 #include <sstream>
 #include <string>
 #include <tuple>
@@ -8,9 +10,19 @@
 
 using Image = std::tuple<uint32_t*, int, int>;
 
+constexpr int k_imageWidth = 640;
+
 std::string getHomeDirectory();
 std::string getPathSeparator();
 
+// Stops the C library from translating line endings in stdin or stdout,
+// which only happens on Windows, so binary data can go through them.
+void setBinaryMode(FILE* stream);
+
+// FFTW's planner isn't thread safe. Hold this while creating or destroying
+// plans, or allocating and freeing FFTW arrays, on any thread.
+std::mutex& getFFTWPlannerMutex();
+
 int nextPowerOfTwo(int x);
 
 int getRed(int color);
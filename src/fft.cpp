@@ -0,0 +1,143 @@
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <utility>
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif // _WIN32
+
+#include "common.hpp"
+#include "fft.hpp"
+
+namespace fft {
+
+// Must be called with the planner mutex held.
+static fftwf_plan getPlan(int size, bool inverse)
+{
+    static std::map<std::pair<int, bool>, fftwf_plan> plans;
+    auto key = std::make_pair(size, inverse);
+    auto found = plans.find(key);
+    if (found != plans.end()) {
+        return found->second;
+    }
+
+    // Planned on arrays of their own, since FFTW_MEASURE overwrites them.
+    // Arrays from fftwf_alloc_* are all aligned alike, so the plan runs on
+    // any of them.
+    float* real = fftwf_alloc_real(size);
+    fftwf_complex* complex = fftwf_alloc_complex(size / 2 + 1);
+    fftwf_plan plan;
+    if (inverse) {
+        plan = fftwf_plan_dft_c2r_1d(size, complex, real, FFTW_MEASURE);
+    } else {
+        plan = fftwf_plan_dft_r2c_1d(size, real, complex, FFTW_MEASURE);
+    }
+    fftwf_free(real);
+    fftwf_free(complex);
+    plans[key] = plan;
+    return plan;
+}
+
+fftwf_plan getRealToComplexPlan(int size)
+{
+    std::lock_guard<std::mutex> lock(getFFTWPlannerMutex());
+    return getPlan(size, false);
+}
+
+fftwf_plan getComplexToRealPlan(int size)
+{
+    std::lock_guard<std::mutex> lock(getFFTWPlannerMutex());
+    return getPlan(size, true);
+}
+
+void prewarm(const std::vector<int>& sizes)
+{
+    for (int size : sizes) {
+        getRealToComplexPlan(size);
+        getComplexToRealPlan(size);
+    }
+}
+
+std::string getDefaultWisdomPath()
+{
+#if defined(_WIN32)
+    const char* base = std::getenv("LOCALAPPDATA");
+    std::string directory = base != nullptr ? base : getHomeDirectory();
+#elif defined(__APPLE__)
+    std::string directory = getHomeDirectory() + "/Library/Caches";
+#else
+    const char* base = std::getenv("XDG_CACHE_HOME");
+    std::string directory = (
+        base != nullptr && *base != '\0' ? base : getHomeDirectory() + "/.cache"
+    );
+#endif
+    return directory + getPathSeparator() + "canvas" + getPathSeparator() + "fftw_wisdom";
+}
+
+// Makes every directory the file is in that doesn't exist yet.
+static void makeParentDirectories(const std::string& path)
+{
+    for (size_t i = 1; i < path.size(); i++) {
+        if (path[i] != '/' && path[i] != '\\') {
+            continue;
+        }
+        std::string directory = path.substr(0, i);
+#ifdef _WIN32
+        _mkdir(directory.c_str());
+#else
+        mkdir(directory.c_str(), 0777);
+#endif // _WIN32
+    }
+}
+
+WisdomCache::WisdomCache(std::string path)
+    : m_path(path)
+{
+    std::lock_guard<std::mutex> lock(getFFTWPlannerMutex());
+    // A missing or unreadable file just means planning from scratch.
+    fftwf_import_wisdom_from_filename(m_path.c_str());
+    m_loadedWisdom = exportWisdom();
+}
+
+WisdomCache::~WisdomCache()
+{
+    std::lock_guard<std::mutex> lock(getFFTWPlannerMutex());
+    std::string wisdom = exportWisdom();
+    if (wisdom == m_loadedWisdom) {
+        return;
+    }
+    // Written next to the file and renamed over it, so that processes
+    // running at the same time never read half a file.
+    makeParentDirectories(m_path);
+    std::string temporaryPath = m_path + "." + std::to_string(std::random_device()()) + ".tmp";
+    FILE* file = std::fopen(temporaryPath.c_str(), "w");
+    if (file == nullptr) {
+        return;
+    }
+    bool written = std::fputs(wisdom.c_str(), file) >= 0;
+    written = std::fclose(file) == 0 && written;
+    if (written && std::rename(temporaryPath.c_str(), m_path.c_str()) != 0) {
+        // Windows doesn't rename over existing files.
+        std::remove(m_path.c_str());
+        written = std::rename(temporaryPath.c_str(), m_path.c_str()) == 0;
+    }
+    if (!written) {
+        std::remove(temporaryPath.c_str());
+    }
+}
+
+std::string WisdomCache::exportWisdom()
+{
+    char* wisdom = fftwf_export_wisdom_to_string();
+    if (wisdom == nullptr) {
+        return "";
+    }
+    std::string result(wisdom);
+    std::free(wisdom);
+    return result;
+}
+
+} // namespace fft
@@ -0,0 +1,43 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fftw3.h>
+
+namespace fft {
+
+// Plans shared by the whole process, one per size and direction, made with
+// FFTW_MEASURE the first time they are asked for and never destroyed. They
+// are out of place and run with fftwf_execute_dft_r2c or
+// fftwf_execute_dft_c2r on arrays from fftwf_alloc_real and
+// fftwf_alloc_complex, from any thread. Safe to call from any thread.
+fftwf_plan getRealToComplexPlan(int size);
+fftwf_plan getComplexToRealPlan(int size);
+
+// Makes the plans for every size, so their wisdom can be saved before it is
+// needed.
+void prewarm(const std::vector<int>& sizes);
+
+// The per-user wisdom file: under $XDG_CACHE_HOME or ~/.cache on Linux,
+// ~/Library/Caches on macOS, and %LOCALAPPDATA% on Windows.
+std::string getDefaultWisdomPath();
+
+// Loads FFTW wisdom from a file when constructed, if it exists, and saves
+// it back when destroyed if planning learned anything new in between. With
+// the wisdom of a previous run, FFTW_MEASURE plans are made without timing
+// anything.
+class WisdomCache {
+public:
+    explicit WisdomCache(std::string path);
+    ~WisdomCache();
+
+    WisdomCache(const WisdomCache&) = delete;
+    WisdomCache& operator=(const WisdomCache&) = delete;
+
+private:
+    std::string m_path;
+    std::string m_loadedWisdom;
+
+    static std::string exportWisdom();
+};
+
+} // namespace fft
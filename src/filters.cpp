@@ -1,3 +1,5 @@
+#include <cmath>
+
 #include "filters.hpp"
 
 namespace filters {
@@ -124,7 +126,7 @@ void applyChorus(Image image, std::mt19937& randomEngine, float rate, float dept
 }
 
 
-void applyScaleFilter(Image image, int root, int scaleClass)
+void applyScaleFilter(Image image, const Tuning& tuning, int root, int scaleClass)
 {
     auto pixels = std::get<0>(image);
     auto width = std::get<1>(image);
@@ -140,11 +142,26 @@ void applyScaleFilter(Image image, int root, int scaleClass)
         { 1, 0, 1, 1, 0, 1, 1, 0, 1, 1, 0, 1 }, // Octatonic
         { 1, 0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 1 }, // Hexatonic (Messiaen)
     };
+
+    // Keep the row nearest to each pitch of the scale, in 12-EDO relative to
+    // C0, and clear every other row.
+    const float c0 = 440 * std::pow(2, -57 / 12.0);
+    int lowestPitch = std::floor(12 * std::log2(tuning.front() / c0)) - 1;
+    int highestPitch = std::ceil(12 * std::log2(tuning.back() / c0)) + 1;
+    std::vector<bool> keep(height, false);
+    for (int pitch = lowestPitch; pitch <= highestPitch; pitch++) {
+        int offsetFromRoot = ((pitch - root) % 12 + 12) % 12;
+        if (scale[scaleClass][offsetFromRoot] == 0) {
+            continue;
+        }
+        int tuningRow = tuning::findNearestRow(tuning, c0 * std::pow(2, pitch / 12.0));
+        if (tuningRow != -1) {
+            keep[height - 1 - tuningRow] = true;
+        }
+    }
+
     for (int row = 0; row < height; row++) {
-        // Subtract 6 because lowest frequency is A.
-        int stepsIn24EDO = height - 1 - row - 6;
-        int offsetFromRoot = ((stepsIn24EDO / 2 - root) % 12 + 12) % 12;
-        if (stepsIn24EDO % 2 != 0 || scale[scaleClass][offsetFromRoot] == 0) {
+        if (!keep[row]) {
             for (int column = 0; column < width; column++) {
                 pixels[row * width + column] = 0;
             }
@@ -203,8 +220,21 @@ void applyTremolo(Image image, float rate, float depth, int shape, float stereo)
     }
 }
 
+// Image row tuned to the given harmonic, or subharmonic, of an image row's
+// frequency. -1 if there is no such row.
+static int findHarmonicRow(const Tuning& tuning, int row, int harmonic, bool subharmonic)
+{
+    int height = tuning.size();
+    float frequency = tuning[height - 1 - row];
+    int tuningRow = tuning::findNearestRow(
+        tuning, subharmonic ? frequency * harmonic : frequency / harmonic
+    );
+    return tuningRow == -1 ? -1 : height - 1 - tuningRow;
+}
+
 void applyHarmonics(
     Image image,
+    const Tuning& tuning,
     float amplitude2,
     float amplitude3,
     float amplitude4,
@@ -217,41 +247,39 @@ void applyHarmonics(
     auto height = std::get<2>(image);
 
     for (int row = 0; row < height; row++) {
+        int row2 = findHarmonicRow(tuning, row, 2, subharmonics);
+        int row3 = findHarmonicRow(tuning, row, 3, subharmonics);
+        int row4 = findHarmonicRow(tuning, row, 4, subharmonics);
+        int row5 = findHarmonicRow(tuning, row, 5, subharmonics);
         for (int column = 0; column < width; column++) {
             float red2 = 0, green2 = 0, blue2 = 0;
             float red3 = 0, green3 = 0, blue3 = 0;
             float red4 = 0, green4 = 0, blue4 = 0;
             float red5 = 0, green5 = 0, blue5 = 0;
 
-            int sign = subharmonics ? -1 : 1;
-
-            int index2 = (row + 12 * 2 * sign) * width + column;
-            if (0 <= index2 && index2 < width * height) {
-                int color2 = pixels[index2];
+            if (row2 != -1) {
+                int color2 = pixels[row2 * width + column];
                 red2 = getRedNormalized(color2);
                 green2 = getGreenNormalized(color2);
                 blue2 = getBlueNormalized(color2);
             }
 
-            int index3 = (row + (12 + 7) * 2 * sign) * width + column;
-            if (0 <= index3 && index3 < width * height) {
-                int color3 = pixels[index3];
+            if (row3 != -1) {
+                int color3 = pixels[row3 * width + column];
                 red3 = getRedNormalized(color3);
                 green3 = getGreenNormalized(color3);
                 blue3 = getBlueNormalized(color3);
             }
 
-            int index4 = (row + 24 * 2 * sign) * width + column;
-            if (0 <= index4 && index4 < width * height) {
-                int color4 = pixels[index4];
+            if (row4 != -1) {
+                int color4 = pixels[row4 * width + column];
                 red4 = getRedNormalized(color4);
                 green4 = getGreenNormalized(color4);
                 blue4 = getBlueNormalized(color4);
             }
 
-            int index5 = (row + (24 + 4) * 2 * sign) * width + column;
-            if (0 <= index5 && index5 < width * height) {
-                int color5 = pixels[index5];
+            if (row5 != -1) {
+                int color5 = pixels[row5 * width + column];
                 red5 = getRedNormalized(color5);
                 green5 = getGreenNormalized(color5);
                 blue5 = getBlueNormalized(color5);
@@ -4,17 +4,20 @@
 #include <algorithm>
 
 #include "common.hpp"
+#include "Tuning.hpp"
 
 namespace filters {
 
 void clear(Image image);
 void applyInvert(Image image);
-void applyScaleFilter(Image image, int root, int scaleClass);
+// The image must have one row per entry of the tuning.
+void applyScaleFilter(Image image, const Tuning& tuning, int root, int scaleClass);
 void applyReverb(Image image, float decay, float damping, bool reverse);
 void applyChorus(Image image, std::mt19937& randomEngine, float rate, float depth);
 void applyTremolo(Image image, float rate, float depth, int shape, float stereo);
 void applyHarmonics(
     Image image,
+    const Tuning& tuning,
     float amplitude2,
     float amplitude3,
     float amplitude4,
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <fftw3.h>
 #include <sndfile.h>
 
@@ -7,12 +8,224 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
+#include "ColumnMirror.hpp"
+#include "fft.hpp"
 #include "io.hpp"
+#include "SoundFileWriter.hpp"
+#include "StemCache.hpp"
 #include "Synth.hpp"
+#include "WorkerPool.hpp"
 
 namespace io {
 
-Status loadAudio(Image image, std::string fileName)
+// Frequency of a tuning row. Rows past either end continue the spacing of
+// the outermost two rows, or quarter tones if there is only one row.
+static float getRowFrequency(const Tuning& tuning, int row)
+{
+    int size = tuning.size();
+    if (row < 0) {
+        float ratio = size > 1 ? tuning[1] / tuning[0] : std::pow(2, 1 / 24.f);
+        return tuning.front() * std::pow(ratio, row);
+    }
+    if (row >= size) {
+        float ratio = size > 1 ? tuning[size - 1] / tuning[size - 2] : std::pow(2, 1 / 24.f);
+        return tuning.back() * std::pow(ratio, row - (size - 1));
+    }
+    return tuning[row];
+}
+
+// Samples per analysis frame of loadAudio.
+constexpr int k_fftBufferSize = 4096;
+// Frames loadAudio reads at a time from streams, and ahead from files whose
+// columns overlap.
+constexpr int k_readChunkFrames = 1 << 16;
+// Columns loadAudio reads before analyzing them together.
+constexpr int k_columnsPerJob = 64;
+
+// Opens a sound file, or standard input or output for "-".
+static SNDFILE* openSoundFile(const std::string& fileName, int mode, SF_INFO* sf_info)
+{
+    if (fileName != "-") {
+        return sf_open(fileName.c_str(), mode, sf_info);
+    }
+    FILE* stream = mode == SFM_READ ? stdin : stdout;
+    setBinaryMode(stream);
+    // libsndfile writes to the descriptor directly, after anything already
+    // buffered in the stream.
+    if (mode == SFM_WRITE) {
+        std::fflush(stream);
+    }
+    return sf_open_fd(fileno(stream), mode, sf_info, false);
+}
+
+AudioLoader::AudioLoader(int numThreads)
+    : m_fftwPlan(fft::getRealToComplexPlan(k_fftBufferSize))
+    , m_threadBuffers(std::max(numThreads, 1))
+{
+    {
+        std::lock_guard<std::mutex> lock(getFFTWPlannerMutex());
+        for (auto& buffers : m_threadBuffers) {
+            buffers.fftIn = fftwf_alloc_real(k_fftBufferSize);
+            buffers.fftOut = fftwf_alloc_complex(k_fftBufferSize / 2 + 1);
+            buffers.magnitudes.resize(k_fftBufferSize / 2 + 1);
+        }
+    }
+    if (m_threadBuffers.size() > 1) {
+        m_workerPool = std::make_unique<WorkerPool>(
+            m_threadBuffers.size() - 1, WorkerPool::Mode::Offline
+        );
+    }
+
+    m_window.resize(k_fftBufferSize);
+    for (int i = 0; i < k_fftBufferSize; i++) {
+        m_window[i] = 0.5 - 0.5 * std::cos(i * 2 * 3.141592653589 / k_fftBufferSize);
+    }
+}
+
+AudioLoader::~AudioLoader()
+{
+    std::lock_guard<std::mutex> lock(getFFTWPlannerMutex());
+    for (auto& buffers : m_threadBuffers) {
+        fftwf_free(buffers.fftIn);
+        fftwf_free(buffers.fftOut);
+    }
+}
+
+void AudioLoader::updateFilterbank(const Tuning& tuning, float sampleRate)
+{
+    if (tuning == m_filterTuning && sampleRate == m_filterSampleRate) {
+        return;
+    }
+    m_filterTuning = tuning;
+    m_filterSampleRate = sampleRate;
+
+    int height = tuning.size();
+    int spectrumSize = k_fftBufferSize / 2 + 1;
+    float binToFreq = (sampleRate * 0.5f) / spectrumSize;
+    float freqToBin = 1 / binToFreq;
+    m_filterFirstBins.resize(height);
+    m_filterOffsets.resize(height + 1);
+    m_filterWeights.clear();
+    for (int y = 0; y < height; y++) {
+        float minFreq = getRowFrequency(tuning, height - 1 - y - 1);
+        float midFreq = getRowFrequency(tuning, height - 1 - y);
+        float maxFreq = getRowFrequency(tuning, height - 1 - y + 1);
+        int minBin = clamp<int>(static_cast<int>(freqToBin * minFreq), 0, spectrumSize - 1);
+        int midBin = clamp<int>(static_cast<int>(freqToBin * midFreq), 0, spectrumSize - 1);
+        int maxBin = clamp<int>(static_cast<int>(freqToBin * maxFreq), 0, spectrumSize - 1);
+
+        // The weights at minBin and maxBin are zero unless they are midBin,
+        // so the run starts after minBin and stops before maxBin.
+        m_filterOffsets[y] = m_filterWeights.size();
+        m_filterFirstBins[y] = minBin < midBin ? minBin + 1 : midBin;
+        for (int bin = minBin + 1; bin < midBin; bin++) {
+            m_filterWeights.push_back(static_cast<float>(bin - minBin) / (midBin - minBin));
+        }
+        // At the bottom and top of the spectrum, rows can be closer than a
+        // bin, and then midBin takes all of the row.
+        m_filterWeights.push_back(1);
+        for (int bin = midBin + 1; bin < maxBin; bin++) {
+            m_filterWeights.push_back(1 - static_cast<float>(bin - midBin) / (maxBin - midBin));
+        }
+    }
+    m_filterOffsets[height] = m_filterWeights.size();
+}
+
+// Reads stretches of a sound file, in order of their starts.
+//
+// When stretches overlap or nearly touch, it reads ahead sequentially a
+// chunk at a time, and keeps what later stretches will need. Otherwise it
+// seeks to each stretch and reads only that, so reading costs as much as
+// what is analyzed.
+class WindowReader {
+public:
+    // Reads ahead readAheadFrames frames past each stretch, at most.
+    WindowReader(SNDFILE* file, int numChannels, int64_t numFrames, int readAheadFrames)
+        : m_file(file)
+        , m_numChannels(numChannels)
+        , m_numFrames(numFrames)
+        , m_readAheadFrames(readAheadFrames)
+    {
+    }
+
+    // Copies frames [start, start + length), interleaved, into out, padding
+    // with zeros past the end of the file.
+    void read(int64_t start, int length, float* out)
+    {
+        int64_t end = std::min(start + length, m_numFrames);
+        if (end > m_bufferEnd) {
+            fill(start, end);
+        }
+        int64_t numCopied = std::min(end, m_bufferEnd) - start;
+        if (numCopied > 0) {
+            std::copy_n(
+                &m_buffer[(start - m_bufferStart) * m_numChannels],
+                numCopied * m_numChannels,
+                out
+            );
+        } else {
+            numCopied = 0;
+        }
+        std::fill(out + numCopied * m_numChannels, out + length * m_numChannels, 0.0f);
+    }
+
+private:
+    SNDFILE* m_file;
+    int m_numChannels;
+    int64_t m_numFrames;
+    int m_readAheadFrames;
+    std::vector<float> m_buffer;
+    // The frames of the file in m_buffer. The file is positioned at the end.
+    int64_t m_bufferStart = 0;
+    int64_t m_bufferEnd = 0;
+
+    void fill(int64_t start, int64_t end)
+    {
+        if (start < m_bufferEnd) {
+            // Keep the overlap.
+            std::copy(
+                m_buffer.begin() + (start - m_bufferStart) * m_numChannels,
+                m_buffer.begin() + (m_bufferEnd - m_bufferStart) * m_numChannels,
+                m_buffer.begin()
+            );
+        } else if (start > m_bufferEnd) {
+            if (sf_seek(m_file, start, SEEK_SET) < 0) {
+                // As far as reading goes, the file ends here.
+                m_numFrames = m_bufferStart = m_bufferEnd = start;
+                return;
+            }
+            m_bufferEnd = start;
+        }
+        m_bufferStart = start;
+
+        int64_t readEnd = std::min(end + m_readAheadFrames, m_numFrames);
+        m_buffer.resize((readEnd - m_bufferStart) * m_numChannels);
+        sf_count_t framesRead = sf_readf_float(
+            m_file,
+            &m_buffer[(m_bufferEnd - m_bufferStart) * m_numChannels],
+            readEnd - m_bufferEnd
+        );
+        m_bufferEnd += std::max<sf_count_t>(framesRead, 0);
+        // A file shorter than its header says ends where reading stopped.
+        if (m_bufferEnd < readEnd) {
+            m_numFrames = m_bufferEnd;
+        }
+    }
+};
+
+Status loadAudio(Image image, const Tuning& tuning, std::string fileName, int numThreads)
+{
+    AudioLoader loader(numThreads);
+    return loader.load(image, tuning, fileName, AudioFileType::Default, 0);
+}
+
+Status AudioLoader::load(
+    Image image,
+    const Tuning& tuning,
+    std::string fileName,
+    AudioFileType fileType,
+    float rawSampleRate
+)
 {
     uint32_t* pixels = std::get<0>(image);
     int width = std::get<1>(image);
@@ -20,7 +233,12 @@ Status loadAudio(Image image, std::string fileName)
 
     SF_INFO sf_info;
     sf_info.format = 0;
-    auto soundFile = sf_open(fileName.c_str(), SFM_READ, &sf_info);
+    if (fileType == AudioFileType::Raw) {
+        sf_info.format = SF_FORMAT_RAW | SF_FORMAT_FLOAT | SF_ENDIAN_LITTLE;
+        sf_info.channels = 2;
+        sf_info.samplerate = rawSampleRate;
+    }
+    auto soundFile = openSoundFile(fileName, SFM_READ, &sf_info);
 
     if (soundFile == nullptr) {
         return std::make_tuple(
@@ -34,74 +252,64 @@ Status loadAudio(Image image, std::string fileName)
         return std::make_tuple(false, "File must have 1 or 2 channels");
     }
 
-    int frames = sf_info.frames;
-    float* audio = new float[sf_info.frames * sf_info.channels];
-    sf_readf_float(soundFile, audio, sf_info.frames);
-    sf_close(soundFile);
-
-    int fftBufferSize = 4096;
-    int spectrumSize = fftBufferSize / 2 + 1;
-    float* fftInBuffer = new float[fftBufferSize];
-    auto fftOutBuffer = static_cast<fftwf_complex*>(
-        fftwf_malloc(sizeof(fftwf_complex) * spectrumSize)
+    int numChannels = sf_info.channels;
+    bool isStream = !sf_info.seekable;
+    int64_t numFrames = sf_info.frames;
+    if (isStream) {
+        numFrames = 0;
+        while (true) {
+            m_audio.resize((numFrames + k_readChunkFrames) * numChannels);
+            sf_count_t framesRead = sf_readf_float(
+                soundFile, &m_audio[numFrames * numChannels], k_readChunkFrames
+            );
+            if (framesRead <= 0) {
+                break;
+            }
+            numFrames += framesRead;
+        }
+        m_audio.resize(numFrames * numChannels);
+    }
+    // Columns overlap unless the file is more than an FFT per column long.
+    bool columnsOverlap = numFrames / width < k_fftBufferSize;
+    WindowReader reader(
+        soundFile, numChannels, numFrames, columnsOverlap ? k_readChunkFrames : 0
     );
-    float* magnitudeSpectrum = new float[spectrumSize];
-    float* imageTmp = new float[height * width * 2];
 
-    auto fftwPlan = fftwf_plan_dft_r2c_1d(
-        fftBufferSize, fftInBuffer, fftOutBuffer, FFTW_MEASURE
-    );
+    // Mono files leave every other entry alone.
+    m_imageTmp.assign(height * width * 2, 0);
+    float* imageTmp = m_imageTmp.data();
+    m_columnSamples.resize(k_columnsPerJob * k_fftBufferSize * numChannels);
 
-    for (int channel = 0; channel < sf_info.channels; channel++) {
-        for (int x = 0; x < width; x++) {
-            int offset = x * static_cast<float>(sf_info.frames) / width;
-            for (int i = 0; i < fftBufferSize; i++) {
-                float window = 0.5 - 0.5 * std::cos(i * 2 * 3.141592653589 / fftBufferSize);
-                if (offset + i >= sf_info.frames) {
-                    fftInBuffer[i] = 0;
-                } else {
-                    if (sf_info.channels == 1) {
-                        fftInBuffer[i] = audio[offset + i] * window;
-                    } else {
-                        fftInBuffer[i] = audio[(offset + i) * 2 + channel] * window;
-                    }
-                }
+    updateFilterbank(tuning, sf_info.samplerate);
+    m_job.numChannels = numChannels;
+    m_job.width = width;
+    m_job.height = height;
+    for (int firstColumn = 0; firstColumn < width; firstColumn += k_columnsPerJob) {
+        int numColumns = std::min(k_columnsPerJob, width - firstColumn);
+        for (int i = 0; i < numColumns; i++) {
+            int64_t offset = (firstColumn + i) * static_cast<float>(numFrames) / width;
+            float* samples = &m_columnSamples[i * k_fftBufferSize * numChannels];
+            if (!isStream) {
+                reader.read(offset, k_fftBufferSize, samples);
+                continue;
+            }
+            int numSamples = clamp<int64_t>(numFrames - offset, 0, k_fftBufferSize);
+            std::fill(samples, samples + k_fftBufferSize * numChannels, 0.0f);
+            if (numSamples > 0) {
+                std::copy_n(&m_audio[offset * numChannels], numSamples * numChannels, samples);
             }
-            fftwf_execute(fftwPlan);
-
-            float binToFreq = (sf_info.samplerate * 0.5f) / spectrumSize;
-            float freqToBin = 1 / binToFreq;
-            for (int y = 0; y < height; y++) {
-                float minFreq = 27.5 * std::pow(2, (height - 1 - y - 1) / 24.f);
-                float midFreq = 27.5 * std::pow(2, (height - 1 - y) / 24.f);
-                float maxFreq = 27.5 * std::pow(2, (height - 1 - y + 1) / 24.f);
-                int minBin = clamp<int>(static_cast<int>(freqToBin * minFreq), 0, spectrumSize - 1);
-                int midBin = clamp<int>(static_cast<int>(freqToBin * midFreq), 0, spectrumSize - 1);
-                int maxBin = clamp<int>(static_cast<int>(freqToBin * maxFreq), 0, spectrumSize - 1);
+        }
 
-                float amplitude = 0;
-                for (int bin = minBin; bin < midBin; bin++) {
-                    float binAmplitude = std::hypot(
-                        fftOutBuffer[bin][0], fftOutBuffer[bin][1]
-                    );
-                    float multiplier = (
-                        static_cast<float>(bin - minBin) / (midBin - minBin)
-                    );
-                    amplitude += binAmplitude * multiplier;
-                }
-                for (int bin = midBin; bin <= maxBin; bin++) {
-                    float binAmplitude = std::hypot(
-                        fftOutBuffer[bin][0], fftOutBuffer[bin][1]
-                    );
-                    float multiplier = (
-                        1 - static_cast<float>(bin - midBin) / (maxBin - midBin)
-                    );
-                    amplitude += binAmplitude * multiplier;
-                }
-                imageTmp[(y * width + x) * 2 + channel] = amplitude;
-            };
+        m_job.firstColumn = firstColumn;
+        m_job.numColumns = numColumns;
+        m_job.numTasks = std::min<int>(m_threadBuffers.size(), numColumns);
+        if (m_job.numTasks > 1) {
+            m_workerPool->run(&runAnalysisTask, this, m_job.numTasks);
+        } else {
+            analyzeColumns(0);
         }
     }
+    sf_close(soundFile);
 
     float overallMaxAmplitude = 0;
     for (int i = 0; i < height * width * 2; i++) {
@@ -120,100 +328,606 @@ Status loadAudio(Image image, std::string fileName)
         pixels[i] = colorFromNormalized(right, 0, left);
     }
 
-    fftwf_free(fftOutBuffer);
-    delete[] imageTmp;
-    delete[] magnitudeSpectrum;
-    delete[] fftInBuffer;
-    delete[] audio;
-
     return std::make_tuple(true, "");
 }
 
+void AudioLoader::runAnalysisTask(void* context, int task)
+{
+    static_cast<AudioLoader*>(context)->analyzeColumns(task);
+}
+
+// Columns don't depend on each other, so tasks write theirs without
+// coordinating, and the result doesn't depend on the number of tasks.
+void AudioLoader::analyzeColumns(int task)
+{
+    const AnalysisJob& job = m_job;
+    ThreadBuffers& buffers = m_threadBuffers[task];
+    int fftBufferSize = k_fftBufferSize;
+    int spectrumSize = fftBufferSize / 2 + 1;
+    float* fftInBuffer = buffers.fftIn;
+    fftwf_complex* fftOutBuffer = buffers.fftOut;
+    float* magnitudes = buffers.magnitudes.data();
+    const float* window = m_window.data();
+    float* imageTmp = m_imageTmp.data();
+    int width = job.width;
+    int firstColumn = job.firstColumn + job.numColumns * task / job.numTasks;
+    int lastColumn = job.firstColumn + job.numColumns * (task + 1) / job.numTasks;
+
+    for (int channel = 0; channel < job.numChannels; channel++) {
+        for (int x = firstColumn; x < lastColumn; x++) {
+            const float* samples = &m_columnSamples[
+                (x - job.firstColumn) * fftBufferSize * job.numChannels + channel
+            ];
+            for (int i = 0; i < fftBufferSize; i++) {
+                fftInBuffer[i] = samples[i * job.numChannels] * window[i];
+            }
+            // Unlike planning, executing a plan is thread safe.
+            fftwf_execute_dft_r2c(m_fftwPlan, fftInBuffer, fftOutBuffer);
+
+            // Neighboring rows share bins, so each magnitude is worked out
+            // once for all of them.
+            for (int bin = 0; bin < spectrumSize; bin++) {
+                magnitudes[bin] = std::hypot(fftOutBuffer[bin][0], fftOutBuffer[bin][1]);
+            }
+            for (int y = 0; y < job.height; y++) {
+                const float* weights = &m_filterWeights[m_filterOffsets[y]];
+                const float* binMagnitudes = &magnitudes[m_filterFirstBins[y]];
+                int numBins = m_filterOffsets[y + 1] - m_filterOffsets[y];
+                float amplitude = 0;
+                for (int i = 0; i < numBins; i++) {
+                    amplitude += binMagnitudes[i] * weights[i];
+                }
+                imageTmp[(y * width + x) * 2 + channel] = amplitude;
+            }
+        }
+    }
+}
+
+// Identifies the synth's output in stem cache keys. Bump it whenever a
+// change to the synth changes what a row sounds like.
+constexpr int k_synthVersion = 2;
+
+// Frames a render is streamed to the file in, per thread. Each thread needs
+// two segments of buffers, one being rendered and one being written.
+constexpr int k_streamSegmentFrames = 1 << 16;
+
+RenderQuality getDraftQuality()
+{
+    RenderQuality quality;
+    quality.sampleRateDivisor = 4;
+    quality.maxPartials = 32;
+    quality.controlBlockSize = 256;
+    quality.phaseDistortion = false;
+    return quality;
+}
+
+std::string getDraftFileName(std::string fileName)
+{
+    size_t nameStart = fileName.find_last_of("/\\");
+    nameStart = nameStart == std::string::npos ? 0 : nameStart + 1;
+    size_t extension = fileName.rfind('.');
+    if (extension == std::string::npos || extension <= nameStart) {
+        return fileName + "-draft";
+    }
+    return fileName.substr(0, extension) + "-draft" + fileName.substr(extension);
+}
+
+// For each column, how loud a rendered row must be, as left plus right
+// amplitude, to be among the maxPartials loudest. Ties are all kept. 0 keeps
+// every row.
+static std::vector<float> findCullThresholds(
+    const ColumnMirror& columns,
+    const std::vector<bool>& rowsRendered,
+    int width,
+    int maxPartials
+)
+{
+    int height = rowsRendered.size();
+    std::vector<float> thresholds(width, 0);
+    if (maxPartials <= 0) {
+        return thresholds;
+    }
+    std::vector<float> loudness(height);
+    for (int x = 0; x < width; x++) {
+        const float* column = columns.getColumn(x);
+        int numAudible = 0;
+        for (int i = 0; i < height; i++) {
+            float rowLoudness = column[2 * i] + column[2 * i + 1];
+            if (rowsRendered[i] && rowLoudness != 0) {
+                loudness[numAudible++] = rowLoudness;
+            }
+        }
+        if (numAudible > maxPartials) {
+            std::nth_element(
+                loudness.begin(),
+                loudness.begin() + maxPartials - 1,
+                loudness.begin() + numAudible,
+                std::greater<float>()
+            );
+            thresholds[x] = loudness[maxPartials - 1];
+        }
+    }
+    return thresholds;
+}
+
+// What a render plays, the same for every row and segment of it.
+struct RenderPlan {
+    const ColumnMirror& columns;
+    // Rows not to be rendered at all, and for each column how loud a row
+    // must be to be rendered.
+    const std::vector<bool>& rowsRendered;
+    const std::vector<float>& cullThresholds;
+    int width;
+    float overallGain;
+    // Frames between amplitude updates.
+    int blockSize;
+    int numFrames;
+};
+
+// Plays the plan through a synth, one stretch of blocks at a time.
+// Oscillator i of the synth plays row firstRow + i, counting from the bottom.
+//
+// Stretches must come in order, but may leave gaps. The blocks in a gap
+// aren't rendered, but their amplitudes are still followed so partials come
+// and go as they would have. Rendering resumes a little before the next
+// stretch, so the output has settled into what rendering all along gives by
+// its first block.
+class RowRenderer {
+public:
+    RowRenderer(Synth& synth, const RenderPlan& plan, int firstRow);
+
+    // Writes the frames of blocks [firstBlock, lastBlock) to audio as
+    // interleaved stereo, stopping at the end of the plan.
+    void render(int firstBlock, int lastBlock, float* audio);
+
+private:
+    Synth& m_synth;
+    const RenderPlan& m_plan;
+    const int m_firstRow;
+
+    // Amplitudes only need setting where a new run of columns starts, or
+    // which rows are culled changes. In between, the synth holds them
+    // without ramping.
+    std::vector<int> m_runs;
+    int m_lastRun = -1;
+    float m_lastThreshold = 0;
+
+    int m_nextBlock = 0;
+    std::vector<float> m_left;
+    std::vector<float> m_right;
+
+    void updateAmplitudes(int block);
+};
+
+RowRenderer::RowRenderer(Synth& synth, const RenderPlan& plan, int firstRow)
+    : m_synth(synth)
+    , m_plan(plan)
+    , m_firstRow(firstRow)
+    , m_runs(plan.columns.findRuns(firstRow, synth.getNumOscillators()))
+    , m_left(plan.blockSize)
+    , m_right(plan.blockSize)
+{
+}
+
+void RowRenderer::updateAmplitudes(int block)
+{
+    // Read ahead by the synth's latency, so amplitude changes land on time.
+    // The first frames of a render can't be made up for.
+    int64_t sampleOffset = (
+        static_cast<int64_t>(block) * m_plan.blockSize + m_synth.getLatency(m_plan.blockSize)
+    );
+    int position = static_cast<float>(sampleOffset) * m_plan.width / m_plan.numFrames;
+    // Rounding, or the latency, can land on a column past the end.
+    position = std::min(position, m_plan.width - 1);
+    float threshold = m_plan.cullThresholds[position];
+    if (m_runs[position] == m_lastRun && threshold == m_lastThreshold) {
+        return;
+    }
+    m_lastRun = m_runs[position];
+    m_lastThreshold = threshold;
+    int numRows = m_synth.getNumOscillators();
+    const float* column = m_plan.columns.getColumn(position) + 2 * m_firstRow;
+    for (int i = 0; i < numRows; i++) {
+        float left = column[2 * i];
+        float right = column[2 * i + 1];
+        if (!m_plan.rowsRendered[m_firstRow + i] || left + right < threshold) {
+            left = 0;
+            right = 0;
+        }
+        m_synth.setOscillatorAmplitude(
+            i, left * m_plan.overallGain, right * m_plan.overallGain
+        );
+    }
+}
+
+void RowRenderer::render(int firstBlock, int lastBlock, float* audio)
+{
+    int outChannels = 2;
+    int blockSize = m_plan.blockSize;
+    float* outBuffer[2] = { m_left.data(), m_right.data() };
+
+    int settleBlocks = (k_skipSettleFrames + blockSize - 1) / blockSize;
+    int startBlock = std::max(firstBlock - settleBlocks, m_nextBlock);
+    for (; m_nextBlock < startBlock; m_nextBlock++) {
+        updateAmplitudes(m_nextBlock);
+        m_synth.skip(1, blockSize);
+    }
+
+    for (; m_nextBlock < lastBlock; m_nextBlock++) {
+        updateAmplitudes(m_nextBlock);
+        m_synth.process(
+            outChannels, outBuffer, blockSize
+        );
+        if (m_nextBlock < firstBlock) {
+            continue;
+        }
+        int64_t sampleOffset = static_cast<int64_t>(m_nextBlock) * blockSize;
+        float* out = audio + (sampleOffset - static_cast<int64_t>(firstBlock) * blockSize) * 2;
+        for (int i = 0; i < blockSize; i++) {
+            if (sampleOffset + i >= m_plan.numFrames) {
+                break;
+            }
+            out[i * 2] = outBuffer[0][i];
+            out[i * 2 + 1] = outBuffer[1][i];
+        }
+    }
+}
+
+// Splits the timeline into segments of blocks, and renders a round of
+// consecutive segments at a time, one per task of a WorkerPool. Each task
+// has its own synth, restarted for every row of a stem render, and renders
+// every segment of its row that falls to it.
+struct SegmentJob {
+    const RenderPlan* plan;
+    float sampleRate;
+    float pdMode;
+    float pdDistort;
+    PhaseMode phaseMode;
+    SynthEngine engine;
+    int numBlocks;
+    int segmentBlocks;
+    std::vector<std::unique_ptr<Synth>> synths;
+    // Cleared to start over from the first block.
+    std::vector<std::unique_ptr<RowRenderer>> renderers;
+
+    // What to render.
+    const Tuning* tuning;
+    const std::vector<float>* phases;
+    int firstRow;
+
+    // The round to render, and where its first segment starts.
+    int firstSegment;
+    float* audio;
+};
+
+static void renderSegment(void* context, int task)
+{
+    SegmentJob& job = *static_cast<SegmentJob*>(context);
+    if (!job.renderers[task]) {
+        auto& synth = job.synths[task];
+        if (synth) {
+            synth->restart(*job.tuning, *job.phases);
+        } else {
+            synth = std::make_unique<Synth>(job.sampleRate, *job.tuning, *job.phases);
+            synth->setPDMode(job.pdMode);
+            synth->setPDDistort(job.pdDistort);
+            synth->setPhaseMode(job.phaseMode);
+            synth->setEngine(job.engine);
+            synth->waitForWavetables();
+        }
+        job.renderers[task] = std::make_unique<RowRenderer>(*synth, *job.plan, job.firstRow);
+    }
+    int64_t firstBlock = static_cast<int64_t>(job.firstSegment + task) * job.segmentBlocks;
+    int64_t lastBlock = std::min<int64_t>(firstBlock + job.segmentBlocks, job.numBlocks);
+    if (firstBlock >= lastBlock) {
+        return;
+    }
+    float* audio = job.audio + (
+        static_cast<int64_t>(task) * job.segmentBlocks * job.plan->blockSize * 2
+    );
+    job.renderers[task]->render(firstBlock, lastBlock, audio);
+}
+
+// Whether the row, counting from the bottom, has any audible pixels.
+static bool isRowAudible(Image image, int row)
+{
+    uint32_t* pixels = std::get<0>(image);
+    int width = std::get<1>(image);
+    int height = std::get<2>(image);
+    for (int x = 0; x < width; x++) {
+        int color = pixels[width * (height - 1 - row) + x];
+        if (getBlue(color) != 0 || getRed(color) != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The header of a WAV file of numFrames stereo frames, with float samples
+// for a bitDepth of 0. libsndfile can't write WAV to a pipe, since it goes
+// back to fill in the lengths when the file is closed, but a render knows
+// its length up front, so the header is written here and the samples after
+// it as a raw file.
+static std::string getWavHeader(int sampleRate, int bitDepth, int64_t numFrames)
+{
+    bool isFloat = bitDepth == 0;
+    int bytesPerSample = isFloat ? 4 : bitDepth / 8;
+    int blockAlign = 2 * bytesPerSample;
+    int formatChunkSize = isFloat ? 18 : 16;
+    int headerSize = 12 + 8 + formatChunkSize + (isFloat ? 12 : 0) + 8;
+    // Sizes are 32 bits. Players go by the length of the stream when a file
+    // is longer.
+    uint32_t dataSize = std::min<int64_t>(numFrames * blockAlign, 0xffffffffu - headerSize);
+
+    std::string header;
+    auto add16 = [&](uint32_t x) {
+        header += static_cast<char>(x & 0xff);
+        header += static_cast<char>((x >> 8) & 0xff);
+    };
+    auto add32 = [&](uint32_t x) {
+        add16(x & 0xffff);
+        add16(x >> 16);
+    };
+    header += "RIFF";
+    add32(headerSize - 8 + dataSize);
+    header += "WAVE";
+    header += "fmt ";
+    add32(formatChunkSize);
+    // WAVE_FORMAT_IEEE_FLOAT or WAVE_FORMAT_PCM.
+    add16(isFloat ? 3 : 1);
+    add16(2);
+    add32(sampleRate);
+    add32(sampleRate * blockAlign);
+    add16(blockAlign);
+    add16(8 * bytesPerSample);
+    if (isFloat) {
+        add16(0);
+        header += "fact";
+        add32(4);
+        add32(dataSize / blockAlign);
+    }
+    header += "data";
+    add32(dataSize);
+    return header;
+}
+
 Status renderAudio(
     Image image,
+    const Tuning& tuning,
     std::string fileName,
     std::mt19937& randomEngine,
-    float sampleRate,
-    float overallGain,
-    float speedInPixelsPerSecond,
-    float pdMode,
-    float pdDistort
+    const RenderSettings& settings
 )
 {
     uint32_t* pixels = std::get<0>(image);
     int width = std::get<1>(image);
     int height = std::get<2>(image);
 
-    if (speedInPixelsPerSecond < 0.01) {
+    const RenderQuality& quality = settings.quality;
+    AudioFileType fileType = settings.fileType;
+    SampleFormat sampleFormat = settings.sampleFormat;
+    float sampleRate = settings.sampleRate / quality.sampleRateDivisor;
+    float pdDistort = quality.phaseDistortion ? settings.pdDistort : 0;
+    int numThreads = settings.numThreads;
+
+    if (settings.speedInPixelsPerSecond < 0.01) {
         return std::make_tuple(false, "Speed is too slow to render audio.");
     }
 
-    if (!endsWith(fileName, ".wav")) {
-        return std::make_tuple(false, "File name must end in .wav");
+    bool toStandardOutput = fileName == "-";
+    if (fileType == AudioFileType::Default) {
+        if (endsWith(fileName, ".wav")) {
+            fileType = AudioFileType::WAV;
+        } else if (endsWith(fileName, ".flac")) {
+            fileType = AudioFileType::FLAC;
+        } else if (toStandardOutput) {
+            return std::make_tuple(false, "Audio on standard output needs a file type");
+        } else {
+            return std::make_tuple(false, "File name must end in .wav or .flac");
+        }
+    }
+    bool isFlac = fileType == AudioFileType::FLAC;
+    if (isFlac && toStandardOutput) {
+        return std::make_tuple(false, "FLAC can't be written to standard output");
+    }
+    if (sampleFormat == SampleFormat::Default) {
+        sampleFormat = isFlac ? SampleFormat::PCM24 : SampleFormat::Float;
+    }
+    if (isFlac && sampleFormat == SampleFormat::Float) {
+        return std::make_tuple(false, "FLAC files can't hold float samples");
+    }
+    int bitDepth = 0;
+    int subtype = SF_FORMAT_FLOAT;
+    if (sampleFormat == SampleFormat::PCM16) {
+        bitDepth = 16;
+        subtype = SF_FORMAT_PCM_16;
+    } else if (sampleFormat == SampleFormat::PCM24) {
+        bitDepth = 24;
+        subtype = SF_FORMAT_PCM_24;
+    }
+
+    // Rows only add up to the whole when each one is synthesized the same
+    // way on its own.
+    StemCache stemCache(settings.stemCacheDirectory);
+    bool useStemCache = settings.stemCacheDirectory != "";
+    if (useStemCache && settings.engine != SynthEngine::Oscillators) {
+        return std::make_tuple(false, "The stem cache only works with the oscillators engine");
+    }
+    // Chunks after the first start by skipping ahead, which only the
+    // oscillators engine can do.
+    if (numThreads > 1 && settings.engine != SynthEngine::Oscillators) {
+        return std::make_tuple(
+            false, "Rendering on several threads only works with the oscillators engine"
+        );
+    }
+    if (useStemCache && !stemCache.open()) {
+        return std::make_tuple(
+            false, "Can't use stem cache directory '" + settings.stemCacheDirectory + "'"
+        );
     }
 
+    int numFrames = (
+        static_cast<float>(width) / settings.speedInPixelsPerSecond * sampleRate
+    );
+
     SF_INFO sf_info;
     sf_info.samplerate = sampleRate;
     sf_info.channels = 2;
-    sf_info.format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+    if (fileType == AudioFileType::WAV && !toStandardOutput) {
+        sf_info.format = SF_FORMAT_WAV | subtype;
+    } else if (fileType == AudioFileType::FLAC) {
+        sf_info.format = SF_FORMAT_FLAC | subtype;
+    } else {
+        sf_info.format = SF_FORMAT_RAW | SF_ENDIAN_LITTLE | subtype;
+    }
     sf_info.sections = 0;
     sf_info.seekable = 0;
-    auto soundFile = sf_open(fileName.c_str(), SFM_WRITE, &sf_info);
+    if (fileType == AudioFileType::WAV && toStandardOutput) {
+        setBinaryMode(stdout);
+        std::string header = getWavHeader(sampleRate, bitDepth, numFrames);
+        std::fwrite(header.data(), 1, header.size(), stdout);
+    }
+    auto soundFile = openSoundFile(fileName, SFM_WRITE, &sf_info);
 
     if (soundFile == nullptr) {
         return std::make_tuple(
             false, std::string("Audio rendering failed: ") + sf_strerror(soundFile)
         );
     }
-
-    int numFrames = (
-        static_cast<float>(width) / speedInPixelsPerSecond * sampleRate
+    ColumnMirror columns(width, height);
+    columns.updateAll(image);
+    // Rows the reduced sample rate can't hold would wrap around.
+    std::vector<bool> rowsRendered(height, true);
+    if (quality.sampleRateDivisor > 1) {
+        for (int row = 0; row < height; row++) {
+            rowsRendered[row] = tuning[row] < sampleRate / 2;
+        }
+    }
+    std::vector<float> cullThresholds = findCullThresholds(
+        columns, rowsRendered, width, quality.maxPartials
     );
-    float* audio = new float[numFrames * 2];
 
-    Synth synth(sampleRate, randomEngine);
-    synth.setPDMode(pdMode);
-    synth.setPDDistort(pdDistort);
-
-    int inChannels = 0;
-    int outChannels = 2;
-    int blockSize = 64;
-
-    float* leftOutBuffer = new float[blockSize];
-    float* rightOutBuffer = new float[blockSize];
-    float* outBuffer[2] = { leftOutBuffer, rightOutBuffer };
+    RenderPlan plan {
+        columns,
+        rowsRendered,
+        cullThresholds,
+        width,
+        settings.overallGain,
+        quality.controlBlockSize,
+        numFrames
+    };
+    SegmentJob job;
+    job.plan = &plan;
+    job.sampleRate = sampleRate;
+    job.pdMode = settings.pdMode;
+    job.pdDistort = pdDistort;
+    job.phaseMode = settings.phaseMode;
+    job.engine = settings.engine;
+    job.numBlocks = (numFrames + plan.blockSize - 1) / plan.blockSize;
+    // Stems are rendered whole, a chunk per thread. Otherwise the render is
+    // streamed to the file, so memory use doesn't grow with its length.
+    if (useStemCache) {
+        numThreads = std::max(std::min(numThreads, job.numBlocks), 1);
+        job.segmentBlocks = (job.numBlocks + numThreads - 1) / numThreads;
+    } else {
+        job.segmentBlocks = std::max(k_streamSegmentFrames / plan.blockSize, 1);
+        int numSegments = (job.numBlocks + job.segmentBlocks - 1) / job.segmentBlocks;
+        numThreads = std::max(std::min(numThreads, numSegments), 1);
+    }
+    job.synths.resize(numThreads);
+    std::unique_ptr<WorkerPool> workerPool;
+    if (numThreads > 1) {
+        workerPool = std::make_unique<WorkerPool>(
+            numThreads - 1, WorkerPool::Mode::Offline
+        );
+    }
+    auto startRows = [&](const Tuning& rowTuning, const std::vector<float>& rowPhases, int firstRow) {
+        job.tuning = &rowTuning;
+        job.phases = &rowPhases;
+        job.firstRow = firstRow;
+        job.renderers.clear();
+        job.renderers.resize(numThreads);
+    };
+    auto renderRound = [&](int firstSegment, float* audio) {
+        job.firstSegment = firstSegment;
+        job.audio = audio;
+        if (workerPool) {
+            workerPool->run(&renderSegment, &job, numThreads);
+        } else {
+            renderSegment(&job, 0);
+        }
+    };
 
-    int sampleOffset = 0;
-    while (sampleOffset <= numFrames) {
-        int position = static_cast<float>(sampleOffset) * width / numFrames;
-        for (int i = 0; i < height; i++) {
-            int color = pixels[width * (height - 1 - i) + position];
-            synth.setOscillatorAmplitude(
-                i,
-                getBlueNormalized(color) * overallGain,
-                getRedNormalized(color) * overallGain
-            );
+    std::vector<float> phases = Synth::randomPhases(height, randomEngine);
+    bool success;
+    if (!useStemCache) {
+        int roundFrames = numThreads * job.segmentBlocks * plan.blockSize;
+        SoundFileWriter writer(soundFile, roundFrames, bitDepth);
+        startRows(tuning, phases, 0);
+        for (int64_t firstFrame = 0; firstFrame < numFrames; firstFrame += roundFrames) {
+            renderRound(firstFrame / (job.segmentBlocks * plan.blockSize), writer.getBuffer());
+            writer.write(std::min<int64_t>(roundFrames, numFrames - firstFrame));
         }
-        synth.process(
-            outChannels, outBuffer, blockSize
-        );
-        for (int i = 0; i < blockSize; i++) {
-            if (sampleOffset + i >= numFrames) {
-                break;
+        success = writer.finish();
+    } else {
+        // Render rows whose stems aren't cached on their own, and add up
+        // all of them in row order, so the result doesn't depend on what
+        // was cached.
+        std::vector<float> audio(numFrames * 2);
+        std::vector<float> stem(numFrames * 2);
+        for (int row = 0; row < height; row++) {
+            if (!rowsRendered[row] || !isRowAudible(image, row)) {
+                continue;
+            }
+            StemKey key;
+            key.add(k_synthVersion);
+            key.add(tuning[row]);
+            key.add(phases[row]);
+            key.add(sampleRate);
+            key.add(settings.overallGain);
+            key.add(settings.pdMode);
+            key.add(pdDistort);
+            key.add(quality.controlBlockSize);
+            // Whether a row is culled depends on the other rows.
+            for (int x = 0; x < width; x++) {
+                key.add(cullThresholds[x]);
+            }
+            key.add(settings.phaseMode);
+            key.add(width);
+            key.add(numFrames);
+            // Green doesn't affect the sound.
+            for (int x = 0; x < width; x++) {
+                key.add(pixels[width * (height - 1 - row) + x] & 0xff00ff);
+            }
+            if (stemCache.addTo(key.get(), audio.data(), numFrames)) {
+                continue;
             }
-            audio[(sampleOffset + i) * 2] = outBuffer[0][i];
-            audio[(sampleOffset + i) * 2 + 1] = outBuffer[1][i];
+
+            Tuning rowTuning { tuning[row] };
+            std::vector<float> rowPhases { phases[row] };
+            startRows(rowTuning, rowPhases, row);
+            renderRound(0, stem.data());
+            stemCache.store(key.get(), stem.data(), numFrames);
+            for (int i = 0; i < numFrames * 2; i++) {
+                audio[i] += stem[i];
+            }
+        }
+        SoundFileWriter writer(soundFile, k_streamSegmentFrames, bitDepth);
+        for (int64_t firstFrame = 0; firstFrame < numFrames; firstFrame += k_streamSegmentFrames) {
+            int segmentFrames = std::min<int64_t>(k_streamSegmentFrames, numFrames - firstFrame);
+            std::copy_n(&audio[2 * firstFrame], 2 * segmentFrames, writer.getBuffer());
+            writer.write(segmentFrames);
         }
-        sampleOffset += blockSize;
+        success = writer.finish();
     }
 
-    sf_write_float(soundFile, audio, numFrames * 2);
+    if (!success) {
+        std::string error = sf_strerror(soundFile);
+        sf_close(soundFile);
+        return std::make_tuple(false, "Audio rendering failed: " + error);
+    }
     sf_close(soundFile);
 
-    delete[] audio;
-    delete[] leftOutBuffer;
-    delete[] rightOutBuffer;
-
     return std::make_tuple(true, "");
 }
 
@@ -227,9 +941,17 @@ Status loadImage(Image image, std::string fileName)
     int loadedImageHeight;
     int unused;
     int channels = 3;
-    unsigned char* imageData = stbi_load(
-        fileName.c_str(), &loadedImageWidth, &loadedImageHeight, &unused, channels
-    );
+    unsigned char* imageData;
+    if (fileName == "-") {
+        setBinaryMode(stdin);
+        imageData = stbi_load_from_file(
+            stdin, &loadedImageWidth, &loadedImageHeight, &unused, channels
+        );
+    } else {
+        imageData = stbi_load(
+            fileName.c_str(), &loadedImageWidth, &loadedImageHeight, &unused, channels
+        );
+    }
     if (imageData == nullptr) {
         return std::make_tuple(
             false,
@@ -255,6 +977,11 @@ Status loadImage(Image image, std::string fileName)
     return std::make_tuple(true, "");
 }
 
+static void writeToStream(void* stream, void* data, int size)
+{
+    std::fwrite(data, 1, size, static_cast<FILE*>(stream));
+}
+
 Status saveImage(Image image, std::string fileName)
 {
     uint32_t* pixels = std::get<0>(image);
@@ -264,7 +991,8 @@ Status saveImage(Image image, std::string fileName)
 
     int channels = 4;
 
-    if (!endsWith(fileName, ".png")) {
+    bool toStandardOutput = fileName == "-";
+    if (!toStandardOutput && !endsWith(fileName, ".png")) {
         return std::make_tuple(false, "File name must end in .png");
     }
 
@@ -283,9 +1011,18 @@ Status saveImage(Image image, std::string fileName)
 
     int strideInBytes = width * channels;
 
-    int success = stbi_write_png(
-        fileName.c_str(), width, height, channels, imageData, strideInBytes
-    );
+    int success;
+    if (toStandardOutput) {
+        setBinaryMode(stdout);
+        success = stbi_write_png_to_func(
+            &writeToStream, stdout, width, height, channels, imageData, strideInBytes
+        );
+        success = success && std::fflush(stdout) == 0;
+    } else {
+        success = stbi_write_png(
+            fileName.c_str(), width, height, channels, imageData, strideInBytes
+        );
+    }
 
     delete[] imageData;
 
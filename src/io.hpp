@@ -1,23 +1,184 @@
 #pragma once
+#include <memory>
 #include <random>
 #include <tuple>
+#include <vector>
+#include <fftw3.h>
 
 #include "common.hpp"
+#include "Synth.hpp"
+#include "Tuning.hpp"
+#include "WorkerPool.hpp"
 
 namespace io {
 
 using Status = std::tuple<bool, std::string>;
 
-Status loadAudio(Image image, std::string fileName);
+// How faithfully renderAudio renders. Each setting trades quality for speed
+// on its own; the defaults are full quality.
+struct RenderQuality {
+    // The file's sample rate is the requested one divided by this. Rows at or
+    // above the lower Nyquist frequency are left out.
+    int sampleRateDivisor = 1;
+    // Partials rendered at a time, the loudest in each column, or 0 for all.
+    // A faint partial costs as much as a loud one.
+    int maxPartials = 0;
+    // Frames between amplitude updates, a multiple of 16. Amplitudes ramp
+    // over each block, so longer blocks blur quick changes.
+    int controlBlockSize = 64;
+    // Whether to apply phase distortion. Without it every partial is a pure
+    // sine, which is much cheaper.
+    bool phaseDistortion = true;
+};
+
+// Settings for auditioning a long render before committing to full quality,
+// many times faster.
+RenderQuality getDraftQuality();
+// Where a draft of a render to fileName goes, so that it doesn't replace a
+// full-quality render: "-draft" is added before the extension.
+std::string getDraftFileName(std::string fileName);
+
+// How samples are stored in a rendered file. Integer formats are dithered.
+enum class SampleFormat {
+    // Float for WAV files and 24-bit for FLAC, which has no float format.
+    Default,
+    Float,
+    PCM16,
+    PCM24
+};
+
+// The kind of an audio file. Only raw files need it to be given when
+// reading; libsndfile works out the others.
+enum class AudioFileType {
+    // Told apart by the extension of the file name.
+    Default,
+    WAV,
+    FLAC,
+    // Headerless little-endian samples, interleaved stereo. Read as floats
+    // at a sample rate given with the type.
+    Raw
+};
+
+// Everything about a render besides the image and its tuning.
+struct RenderSettings {
+    // Before RenderQuality::sampleRateDivisor.
+    float sampleRate = 48000;
+    float overallGain = 0.1;
+    float speedInPixelsPerSecond = 100;
+    float pdMode = 0;
+    float pdDistort = 0;
+    PhaseMode phaseMode = PhaseMode::Float;
+    SynthEngine engine = SynthEngine::Oscillators;
+    // Where the audio of each row is kept between renders, or "" for none.
+    std::string stemCacheDirectory;
+    RenderQuality quality;
+    int numThreads = 1;
+    AudioFileType fileType = AudioFileType::Default;
+    SampleFormat sampleFormat = SampleFormat::Default;
+};
+
+// Functions that take a file name read from standard input or write to
+// standard output when it is "-".
+
+// The image must have one row per entry of the tuning. The columns are
+// analyzed on numThreads threads, with the same result as on one.
+Status loadAudio(Image image, const Tuning& tuning, std::string fileName, int numThreads);
+
+// Does what loadAudio does, keeping the buffers and threads from one file to
+// the next.
+//
+// Files are read a column's worth at a time, seeking past what isn't
+// analyzed, so memory use doesn't depend on their length. Standard input
+// can't seek and doesn't say how long it is, so it is read whole.
+class AudioLoader {
+public:
+    explicit AudioLoader(int numThreads);
+    ~AudioLoader();
+
+    int getNumThreads() { return m_threadBuffers.size(); }
+
+    AudioLoader(const AudioLoader&) = delete;
+    AudioLoader& operator=(const AudioLoader&) = delete;
+
+    Status load(
+        Image image,
+        const Tuning& tuning,
+        std::string fileName,
+        AudioFileType fileType,
+        float rawSampleRate
+    );
+
+private:
+    // What each thread analyzes columns in. FFTW's arrays are aligned the
+    // same way, so one plan runs on any of them.
+    struct ThreadBuffers {
+        float* fftIn;
+        fftwf_complex* fftOut;
+        std::vector<float> magnitudes;
+    };
+
+    // The columns being analyzed, from firstColumn on. Each task takes an
+    // even share of them, in every channel.
+    struct AnalysisJob {
+        int numChannels;
+        int width;
+        int height;
+        int firstColumn;
+        int numColumns;
+        int numTasks;
+    };
+
+    // Shared with the rest of the process.
+    fftwf_plan m_fftwPlan;
+    std::vector<ThreadBuffers> m_threadBuffers;
+    std::unique_ptr<WorkerPool> m_workerPool;
+    AnalysisJob m_job;
+    std::vector<float> m_window;
+    // The samples of each column of the job, a whole FFT's worth each,
+    // interleaved and padded with zeros past the end of the file.
+    std::vector<float> m_columnSamples;
+    // Only for streams, which are read whole.
+    std::vector<float> m_audio;
+    std::vector<float> m_imageTmp;
+
+    // Each row's amplitude is a triangular filter over the FFT bins, from
+    // the frequency of the row below to that of the row above. The filters
+    // are sparse, so each keeps only the run of bins it weighs: row y weighs
+    // bins from m_filterFirstBins[y] by m_filterWeights[m_filterOffsets[y]]
+    // up to m_filterWeights[m_filterOffsets[y + 1]]. They are made for one
+    // tuning and sample rate at a time.
+    Tuning m_filterTuning;
+    float m_filterSampleRate = 0;
+    std::vector<int> m_filterFirstBins;
+    std::vector<int> m_filterOffsets;
+    std::vector<float> m_filterWeights;
+
+    void updateFilterbank(const Tuning& tuning, float sampleRate);
+    static void runAnalysisTask(void* context, int task);
+    void analyzeColumns(int task);
+};
+// Renders with one oscillator per row to a WAV, FLAC, or raw file. The audio
+// is written to the file as it is rendered, so memory use doesn't depend on
+// its length, and a program reading standard output gets it as it comes.
+// FLAC can't be written to standard output.
+//
+// Given a stem cache directory, rows are rendered one at a time, and only
+// those that changed since a previous render with the same settings; the
+// rest come from the cache. That needs the oscillators engine, and memory
+// for the whole render.
+//
+// With several threads, the timeline is split into segments that the threads
+// take turns rendering. Each thread replays the phases and amplitudes of the
+// segments it skips without rendering them, then renders and discards
+// k_skipSettleFrames before its next segment to fill the multirate
+// upsamplers' history, so the output is the same as on one thread. That also
+// needs the oscillators engine.
 Status renderAudio(
     Image image,
+    const Tuning& tuning,
     std::string fileName,
     std::mt19937& randomEngine,
-    float sampleRate,
-    float overallGain,
-    float speedInPixelsPerSecond,
-    float pdMode,
-    float pdDistort
+    const RenderSettings& settings
 );
 Status loadImage(Image image, std::string fileName);
 Status saveImage(Image image, std::string fileName);
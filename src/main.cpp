@@ -1,200 +1,67 @@
+#include <cctype>
+#include <fstream>
 #include <vector>
 
 #include "tclap/CmdLine.h"
 
 #include "App.hpp"
 #include "common.hpp"
-#include "filters.hpp"
+#include "fft.hpp"
 #include "io.hpp"
-
-
-bool matchesFilter(const std::string& filterString, const std::string& filterName)
-{
-    return startsWith(filterString, filterName + "(") && endsWith(filterString, ")");
-}
-
-std::vector<std::string> getFilterArguments(
-    const std::string& filterString,
-    const std::string& filterName
-)
-{
-    int offset = std::string(filterName).size() + 1;
-    auto arguments = filterString.substr(offset, filterString.size() - 1 - offset);
-    std::vector<std::string> trimmedArguments;
-    for (auto argument : split(arguments, ',')) {
-        trimmedArguments.push_back(trim(argument));
-    }
-    return trimmedArguments;
-}
-
-float parseFloatArgument(const std::string& argument)
-{
-    try {
-        float result = std::stof(argument);
-        return result;
-    } catch (std::invalid_argument e) {
-        std::cerr << "Error: invalid float: '" << argument << "'" << std::endl;
-        exit(1);
-    }
-}
-
-bool parseBoolArgument(const std::string& argument)
-{
-    return argument == "true";
-}
-
-int parseLilypondNoteName(const std::string& noteName)
+#include "turbo.hpp"
+
+
+// About a second and a half at 48 kHz, past which playback lags too far behind
+// the GUI to be useful.
+constexpr int k_maxRenderAheadBlocks = 256;
+
+// Everything the command line sets. Lines of a batch manifest are parsed the
+// same way, but only their job is used.
+struct Options {
+    bool turboMode = false;
+    std::string batchFile;
+    std::vector<int> prewarmSizes;
+    turbo::Job job;
+    std::string tuningString = "edo:24";
+    float cpuBudget = 75;
+    std::string stemCacheDirectory;
+    int renderAheadBlocks = 0;
+};
+
+// Reads --in-format and --out-format, where empty means by extension. False
+// if the name isn't a file type.
+bool parseFileType(const std::string& name, turbo::FileType& fileType)
 {
-    std::vector<char> baseNames = { 'c', 'd', 'e', 'f', 'g', 'a', 'b' };
-    std::vector<int> basePitches = { 0, 2, 4, 5, 7, 9, 11 };
-    if (noteName.size() == 0 || noteName.size() > 2) {
-        std::cerr << "Error: invalid note name: '" << noteName << "'";
-        exit(1);
-    }
-    char baseName = noteName[0];
-    bool baseNameFound;
-    int pitch;
-    for (int i = 0; i < baseNames.size(); i++) {
-        if (baseName == baseNames[i]) {
-            pitch = basePitches[i];
-            baseNameFound = true;
-            break;
-        }
-    }
-    if (!baseNameFound) {
-        std::cerr << "Error: invalid note name: '" << noteName << "'";
-        exit(1);
-    }
-    if (noteName.size() == 2) {
-        char inflection = noteName[1];
-        if (inflection == 's') {
-            pitch += 1;
-        } else if (inflection == 'f') {
-            pitch -= 1;
-        } else {
-            std::cerr << "Error: invalid note name: '" << noteName << "'";
-            exit(1);
+    std::vector<std::string> names = { "", "png", "wav", "flac", "raw" };
+    std::vector<turbo::FileType> fileTypes = {
+        turbo::FileType::Default,
+        turbo::FileType::PNG,
+        turbo::FileType::WAV,
+        turbo::FileType::FLAC,
+        turbo::FileType::Raw
+    };
+    for (int i = 0; i < names.size(); i++) {
+        if (name == names[i]) {
+            fileType = fileTypes[i];
+            return true;
         }
     }
-    return pitch % 12;
+    return false;
 }
 
-int getIndexOf(const std::vector<std::string>& vector, const std::string& string)
+// Parses arguments as they would follow the program name on the command line.
+// A line of a batch manifest has no --help or --version, which would exit
+// the whole batch, so they fail like any other unknown argument.
+io::Status parseArguments(
+    std::vector<std::string> arguments, Options& options, bool isManifestLine
+)
 {
-    for (int i = 0; i < vector.size(); i++) {
-        if (string == vector[i]) {
-            return i;
-        }
-    }
-    return -1;
-}
-
-void applyFilterString(
-    Image image,
-    const std::string& filterString,
-    std::mt19937& randomEngine
-) {
-    if (matchesFilter(filterString, "invert")) {
-        filters::applyInvert(image);
-    } else if (matchesFilter(filterString, "reverb")) {
-        auto arguments = getFilterArguments(filterString, "reverb");
-        if (arguments.size() != 3) {
-            std::cerr << "Error: expected 3 arguments to reverb filter" << std::endl;
-            exit(1);
-        }
-        float reverbDecay = parseFloatArgument(arguments[0]);
-        float reverbDamping = parseFloatArgument(arguments[1]);
-        bool reverbReverse = parseBoolArgument(arguments[2]);
-        filters::applyReverb(image, reverbDecay, reverbDamping, reverbReverse);
-    } else if (matchesFilter(filterString, "scale_filter")) {
-        auto arguments = getFilterArguments(filterString, "scale_filter");
-        if (arguments.size() != 2) {
-            std::cerr << "Error: expected 2 arguments to scale filter" << std::endl;
-            exit(1);
-        }
-        auto root = parseLilypondNoteName(arguments[0]);
-        auto scaleClassString = arguments[1];
-        std::vector<std::string> scaleClassNames = {
-            "major",
-            "minor",
-            "acoustic",
-            "harmonic_major",
-            "harmonic_mainor",
-            "whole_tone",
-            "octatonic",
-            "hexatonic"
-        };
-        int scaleClass = getIndexOf(scaleClassNames, scaleClassString);
-        if (scaleClass == -1) {
-            std::cerr
-                << "Error: invalid scale class: " << scaleClassString << std::endl;
-        }
-        filters::applyScaleFilter(image, root, scaleClass);
-    } else if (matchesFilter(filterString, "chorus")) {
-        auto arguments = getFilterArguments(filterString, "chorus");
-        if (arguments.size() != 2) {
-            std::cerr << "Error: expected 2 arguments to chorus filter" << std::endl;
-            exit(1);
-        }
-        float chorusRate = parseFloatArgument(arguments[0]);
-        float chorusDepth = parseFloatArgument(arguments[1]);
-        filters::applyChorus(image, randomEngine, chorusRate, chorusDepth);
-    } else if (matchesFilter(filterString, "tremolo")) {
-        auto arguments = getFilterArguments(filterString, "tremolo");
-        if (arguments.size() != 4) {
-            std::cerr << "Error: expected 4 arguments to tremolo filter" << std::endl;
-            exit(1);
-        }
-        float tremoloRate = parseFloatArgument(arguments[0]);
-        float tremoloDepth = parseFloatArgument(arguments[1]);
-        std::string tremoloShapeString = arguments[2];
-        std::vector<std::string> tremoloShapeNames = {
-            "sine", "triangle", "square", "saw_down", "saw_up"
-        };
-        int tremoloShape = getIndexOf(tremoloShapeNames, tremoloShapeString);
-        if (tremoloShape == -1) {
-            std::cerr << "Error: Invalid tremolo shape: '" << tremoloShapeString << "'";
-            exit(1);
-        }
-        float tremoloStereo = parseFloatArgument(arguments[3]);
-        filters::applyTremolo(
-            image, tremoloRate, tremoloDepth, tremoloShape, tremoloStereo
-        );
-    } else if (matchesFilter(filterString, "harmonics")) {
-        auto arguments = getFilterArguments(filterString, "harmonics");
-        if (arguments.size() != 5) {
-            std::cerr << "Error: expected 5 arguments to tremolo filter" << std::endl;
-            exit(1);
-        }
-        float harmonics2 = parseFloatArgument(arguments[0]);
-        float harmonics3 = parseFloatArgument(arguments[1]);
-        float harmonics4 = parseFloatArgument(arguments[2]);
-        float harmonics5 = parseFloatArgument(arguments[3]);
-        float harmonicsSubharmonics = parseBoolArgument(arguments[4]);
-        filters::applyHarmonics(
-            image, harmonics2, harmonics3, harmonics4, harmonics5, harmonicsSubharmonics
-        );
-    } else {
-        std::cerr << "Syntax error in filter string '" << filterString << "'";
-        exit(1);
-    }
-}
-
-int main(int argc, char** argv) {
-    bool turboMode;
-    std::string inFile;
-    std::string outFile;
-    float sampleRate = 48000;
-    float overallGain = 0.1;
-    float speedInPixelsPerSecond = 100;
-    std::string pdModeString = "pulsar";
-    int pdMode = 0;
-    float pdDistort = 0;
-    std::vector<std::string> filterStrings;
-    int seed;
-
+    turbo::Job& job = options.job;
     try {
-        TCLAP::CmdLine cmd("Canvas: a visual additive synthesizer", ' ', "0.0.1");
+        TCLAP::CmdLine cmd(
+            "Canvas: a visual additive synthesizer", ' ', "0.0.1", !isManifestLine
+        );
+        cmd.setExceptionHandling(false);
         TCLAP::SwitchArg turboSwitch("t", "turbo", "Run in turbo mode", cmd, false);
 
         TCLAP::ValueArg<std::string> inFileArg(
@@ -247,6 +114,64 @@ int main(int argc, char** argv) {
         );
         cmd.add(pdDistortArg);
 
+        TCLAP::SwitchArg fixedPhaseSwitch(
+            "x",
+            "fixed-phase",
+            "Use 32-bit fixed-point phase accumulators if output is an audio file.",
+            cmd,
+            false
+        );
+
+        TCLAP::ValueArg<std::string> engineArg(
+            "g",
+            "engine",
+            "Synthesis engine if output is an audio file. One of oscillators, "
+            "ifft, or auto. ifft is much faster for dense images but ignores "
+            "phase distortion.",
+            false,
+            "oscillators",
+            "string"
+        );
+        cmd.add(engineArg);
+
+        TCLAP::ValueArg<std::string> inFormatArg(
+            "",
+            "in-format",
+            "Type of the input file in turbo mode: png, wav, flac, or raw, "
+            "which is stereo 32-bit floats at the sample rate. Needed when "
+            "the input file is -, standard input. Otherwise the file name's "
+            "extension tells.",
+            false,
+            "",
+            "string"
+        );
+        cmd.add(inFormatArg);
+
+        TCLAP::ValueArg<std::string> outFormatArg(
+            "",
+            "out-format",
+            "Type of the output file in turbo mode: png, wav, flac, or raw. "
+            "Needed when the output file is -, standard output, where audio "
+            "is written as it is rendered. Otherwise the file name's "
+            "extension tells.",
+            false,
+            "",
+            "string"
+        );
+        cmd.add(outFormatArg);
+
+        TCLAP::ValueArg<std::string> sampleFormatArg(
+            "",
+            "sample-format",
+            "Sample format if output is an audio file. One of float, pcm16, "
+            "pcm24, or auto. Integer formats are dithered. auto is float for "
+            ".wav files and pcm24 for .flac files, which can't hold floats.",
+            false,
+            "auto",
+            "string"
+        );
+        cmd.add(sampleFormatArg);
+
         TCLAP::MultiArg<std::string> filterArg(
             "f",
             "filter",
@@ -261,113 +186,334 @@ int main(int argc, char** argv) {
         );
         cmd.add(seedArg);
 
-        cmd.parse(argc, argv);
+        TCLAP::ValueArg<int> rowsArg(
+            "n",
+            "rows",
+            "Number of rows, i.e. partials, for edo and range tunings.",
+            false,
+            tuning::k_defaultNumRows,
+            "int"
+        );
+        cmd.add(rowsArg);
+
+        TCLAP::ValueArg<std::string> tuningArg(
+            "u",
+            "tuning",
+            "Frequencies of the rows, from the bottom up. One of edo:DIVISIONS, "
+            "edo:DIVISIONS:LOWEST_HZ, range:LOWEST_HZ:HIGHEST_HZ (evenly spaced "
+            "in pitch), or hz:F1,F2,... (one row per frequency).",
+            false,
+            "edo:24",
+            "string"
+        );
+        cmd.add(tuningArg);
+
+        TCLAP::ValueArg<float> cpuBudgetArg(
+            "b",
+            "cpu-budget",
+            "Percentage of each audio callback's duration that realtime "
+            "synthesis may take. Nearing it, only the loudest partials are "
+            "rendered. 0 disables this.",
+            false,
+            75,
+            "float"
+        );
+        cmd.add(cpuBudgetArg);
+
+        TCLAP::ValueArg<std::string> stemCacheArg(
+            "c",
+            "stem-cache",
+            "Directory to keep the audio of each row in between renders, so "
+            "that rendering again only synthesizes rows that changed. Needs "
+            "the oscillators engine.",
+            false,
+            "",
+            "string"
+        );
+        cmd.add(stemCacheArg);
+
+        TCLAP::ValueArg<int> renderAheadArg(
+            "a",
+            "render-ahead",
+            "Synthesize this many blocks of audio ahead on a worker thread "
+            "instead of in the audio callback. Each block of 256 samples adds "
+            "latency but gives synthesis more room to handle CPU spikes. 0 "
+            "disables this.",
+            false,
+            0,
+            "int"
+        );
+        cmd.add(renderAheadArg);
+
+        TCLAP::SwitchArg draftSwitch(
+            "q",
+            "draft",
+            "Render audio quickly at reduced quality, for auditioning: a "
+            "quarter of the sample rate, only the 32 loudest rows of each "
+            "column, slower amplitude updates, and no phase distortion.",
+            cmd,
+            false
+        );
 
-        turboMode = turboSwitch.getValue();
-        inFile = inFileArg.getValue();
-        outFile = outFileArg.getValue();
-        sampleRate = sampleRateArg.getValue();
-        speedInPixelsPerSecond = speedArg.getValue();
-        pdModeString = pdModeArg.getValue();
-        pdDistort = pdDistortArg.getValue();
-        filterStrings = filterArg.getValue();
-        seed = seedArg.getValue();
+        TCLAP::ValueArg<int> threadsArg(
+            "j",
+            "threads",
+            "Render audio in turbo mode on this many threads, each taking a "
+            "chunk of the timeline, and analyze audio input on as many. "
+            "Rendering on several needs the oscillators engine. With "
+            "--batch, the number of jobs to run at once instead.",
+            false,
+            1,
+            "int"
+        );
+        cmd.add(threadsArg);
+
+        TCLAP::ValueArg<std::string> batchArg(
+            "",
+            "batch",
+            "Run many turbo mode jobs in one process, listed in this file one "
+            "per line. Each line holds the options of one job, such as "
+            "-i IN -o OUT -f FILTER, with double quotes around arguments that "
+            "contain spaces. Empty lines and lines starting with # are "
+            "skipped. A failed job doesn't stop the others.",
+            false,
+            "",
+            "string"
+        );
+        cmd.add(batchArg);
+
+        TCLAP::ValueArg<std::string> prewarmArg(
+            "",
+            "prewarm-fft",
+            "Plan FFTs of these comma-separated sizes, such as 1024,4096, and "
+            "exit. What FFTW learns goes to the wisdom file in the user's "
+            "cache directory, which later runs load to skip planning.",
+            false,
+            "",
+            "string"
+        );
+        cmd.add(prewarmArg);
+
+        arguments.insert(arguments.begin(), "canvas");
+        cmd.parse(arguments);
+
+        options.turboMode = turboSwitch.getValue();
+        job.inFile = inFileArg.getValue();
+        job.outFile = outFileArg.getValue();
+        job.sampleRate = sampleRateArg.getValue();
+        job.speedInPixelsPerSecond = speedArg.getValue();
+        std::string pdModeString = pdModeArg.getValue();
+        job.pdDistort = pdDistortArg.getValue();
+        if (fixedPhaseSwitch.getValue()) {
+            job.phaseMode = PhaseMode::FixedPoint;
+        }
+        std::string engineString = engineArg.getValue();
+        std::string inFormatString = inFormatArg.getValue();
+        std::string outFormatString = outFormatArg.getValue();
+        std::string sampleFormatString = sampleFormatArg.getValue();
+        job.filterStrings = filterArg.getValue();
+        job.seed = seedArg.getValue();
+        int numRows = rowsArg.getValue();
+        options.tuningString = tuningArg.getValue();
+        options.cpuBudget = cpuBudgetArg.getValue();
+        options.stemCacheDirectory = stemCacheArg.getValue();
+        job.stemCacheDirectory = options.stemCacheDirectory;
+        options.renderAheadBlocks = renderAheadArg.getValue();
+        job.draft = draftSwitch.getValue();
+        job.numThreads = threadsArg.getValue();
+        options.batchFile = batchArg.getValue();
+        std::string prewarmString = prewarmArg.getValue();
 
         if (pdModeString == "saw") {
-            pdMode = 1;
+            job.pdMode = 1;
         } else if (pdModeString == "square") {
-            pdMode = 2;
+            job.pdMode = 2;
         } else if (pdModeString == "sine_pwm") {
-            pdMode = 3;
+            job.pdMode = 3;
         } else {
-            pdMode = 0;
+            job.pdMode = 0;
         }
 
-    } catch (TCLAP::ArgException e) {
-        std::cerr << "Error: " << e.error() << " for arg " << e.argId() << std::endl;
-        exit(1);
-    }
-
-    if (turboMode) {
-        std::mt19937 randomEngine(seed);
+        if (engineString == "ifft") {
+            job.engine = SynthEngine::InverseFFT;
+        } else if (engineString == "auto") {
+            job.engine = SynthEngine::Auto;
+        } else if (engineString == "oscillators") {
+            job.engine = SynthEngine::Oscillators;
+        } else {
+            return std::make_tuple(false, "Invalid engine: '" + engineString + "'");
+        }
 
-        if (inFile == "") {
-            std::cerr << "Error: Input file -i is required in turbo mode" << std::endl;
-            exit(1);
+        if (!parseFileType(inFormatString, job.inFileType)) {
+            return std::make_tuple(false, "Invalid input format: '" + inFormatString + "'");
         }
-        if (outFile == "") {
-            std::cerr << "Error: Output file -o is required in turbo mode" << std::endl;
-            exit(1);
+        if (!parseFileType(outFormatString, job.outFileType)) {
+            return std::make_tuple(false, "Invalid output format: '" + outFormatString + "'");
         }
 
-        bool inFileIsImage = true;
-        bool outFileIsImage = true;
-        if (endsWith(inFile, ".wav")) {
-            inFileIsImage = false;
-        } else if (endsWith(inFile, ".png")) {
-            inFileIsImage = true;
+        if (sampleFormatString == "float") {
+            job.sampleFormat = io::SampleFormat::Float;
+        } else if (sampleFormatString == "pcm16") {
+            job.sampleFormat = io::SampleFormat::PCM16;
+        } else if (sampleFormatString == "pcm24") {
+            job.sampleFormat = io::SampleFormat::PCM24;
+        } else if (sampleFormatString == "auto") {
+            job.sampleFormat = io::SampleFormat::Default;
+        } else {
+            return std::make_tuple(
+                false, "Invalid sample format: '" + sampleFormatString + "'"
+            );
         }
-        if (endsWith(outFile, ".wav")) {
-            outFileIsImage = false;
-        } else if (endsWith(outFile, ".png")) {
-            outFileIsImage = true;
+
+        if (!(options.cpuBudget >= 0 && options.cpuBudget <= 100)) {
+            return std::make_tuple(false, "CPU budget must be from 0 to 100");
         }
 
-        uint32_t* pixels = new uint32_t[k_imageWidth * k_imageHeight];
-        Image image = std::make_tuple(pixels, k_imageWidth, k_imageHeight);
+        if (options.renderAheadBlocks < 0 || options.renderAheadBlocks > k_maxRenderAheadBlocks) {
+            return std::make_tuple(
+                false,
+                "Render-ahead must be from 0 to "
+                + std::to_string(k_maxRenderAheadBlocks) + " blocks"
+            );
+        }
 
-        if (inFileIsImage) {
-            io::Status status = io::loadImage(image, inFile);
-            bool success = std::get<0>(status);
-            std::string message = std::get<1>(status);
-            if (!success) {
-                std::cerr << message << std::endl;
-                exit(1);
-            }
-        } else {
-            io::Status status = io::loadAudio(image, inFile);
-            bool success = std::get<0>(status);
-            std::string message = std::get<1>(status);
-            if (!success) {
-                std::cerr << message << std::endl;
-                exit(1);
+        if (prewarmString != "") {
+            for (auto sizeString : split(prewarmString, ',')) {
+                sizeString = trim(sizeString);
+                int size;
+                try {
+                    size = std::stoi(sizeString);
+                } catch (const std::exception& e) {
+                    size = 0;
+                }
+                if (size < 1) {
+                    return std::make_tuple(false, "Invalid FFT size: '" + sizeString + "'");
+                }
+                options.prewarmSizes.push_back(size);
             }
         }
 
-        for (auto& filterString : filterStrings) {
-            applyFilterString(image, filterString, randomEngine);
+        if (job.numThreads < 1) {
+            return std::make_tuple(false, "Number of threads must be at least 1");
         }
 
-        if (outFileIsImage) {
-            io::Status status = io::saveImage(image, outFile);
-            bool success = std::get<0>(status);
-            std::string message = std::get<1>(status);
-            if (!success) {
-                std::cerr << message << std::endl;
-                exit(1);
+        return tuning::parse(options.tuningString, numRows, job.tuning);
+
+    } catch (TCLAP::ArgException& e) {
+        return std::make_tuple(false, e.error() + " for arg " + e.argId());
+    } catch (TCLAP::ExitException& e) {
+        // --help or --version, which have printed their output.
+        exit(e.getExitStatus());
+    }
+}
+
+// Splits a line of a batch manifest into arguments at whitespace. Double
+// quotes group an argument with spaces in it, such as a filter.
+std::vector<std::string> splitManifestLine(const std::string& line)
+{
+    std::vector<std::string> arguments;
+    std::string argument;
+    bool inArgument = false;
+    bool quoted = false;
+    for (char c : line) {
+        if (c == '"') {
+            quoted = !quoted;
+            inArgument = true;
+        } else if (!quoted && std::isspace(static_cast<unsigned char>(c))) {
+            if (inArgument) {
+                arguments.push_back(argument);
+                argument.clear();
+                inArgument = false;
             }
         } else {
-            io::Status status = io::renderAudio(
-                image,
-                outFile,
-                randomEngine,
-                sampleRate,
-                overallGain,
-                speedInPixelsPerSecond,
-                pdMode,
-                pdDistort
-            );
-            bool success = std::get<0>(status);
-            std::string message = std::get<1>(status);
-            if (!success) {
-                std::cerr << message << std::endl;
-                exit(1);
-            }
+            argument += c;
+            inArgument = true;
         }
+    }
+    if (inArgument) {
+        arguments.push_back(argument);
+    }
+    return arguments;
+}
+
+// Runs every job in the manifest, reporting each one that fails. Returns the
+// exit status: 1 if any failed.
+int runBatch(const std::string& batchFile, int numThreads)
+{
+    std::ifstream file(batchFile);
+    if (!file) {
+        std::cerr << "Error: can't open batch manifest '" << batchFile << "'" << std::endl;
+        return 1;
+    }
 
-        delete[] pixels;
+    std::vector<turbo::Job> jobs;
+    std::vector<int> jobLines;
+    bool anyFailed = false;
+    std::string line;
+    for (int lineNumber = 1; std::getline(file, line); lineNumber++) {
+        auto arguments = splitManifestLine(line);
+        if (arguments.empty() || startsWith(arguments[0], "#")) {
+            continue;
+        }
+        Options jobOptions;
+        auto status = parseArguments(arguments, jobOptions, true);
+        if (!std::get<0>(status)) {
+            std::cerr
+                << "Error: " << batchFile << ":" << lineNumber << ": "
+                << std::get<1>(status) << std::endl;
+            anyFailed = true;
+            continue;
+        }
+        jobs.push_back(jobOptions.job);
+        jobLines.push_back(lineNumber);
+    }
+
+    auto statuses = turbo::runBatch(jobs, numThreads);
+    for (int i = 0; i < jobs.size(); i++) {
+        if (!std::get<0>(statuses[i])) {
+            std::cerr
+                << "Error: " << batchFile << ":" << jobLines[i] << ": "
+                << std::get<1>(statuses[i]) << std::endl;
+            anyFailed = true;
+        }
+    }
+    return anyFailed ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    auto status = parseArguments(
+        std::vector<std::string>(argv + 1, argv + argc), options, false
+    );
+    if (!std::get<0>(status)) {
+        std::cerr << "Error: " << std::get<1>(status) << std::endl;
+        exit(1);
+    }
+
+    // Saves what planning learned when main returns.
+    fft::WisdomCache wisdomCache(fft::getDefaultWisdomPath());
+
+    if (!options.prewarmSizes.empty()) {
+        fft::prewarm(options.prewarmSizes);
+        return 0;
+    }
+
+    if (options.batchFile != "") {
+        return runBatch(options.batchFile, options.job.numThreads);
+    }
+
+    if (options.turboMode) {
+        turbo::Workspace workspace;
+        status = turbo::run(options.job, workspace);
+        if (!std::get<0>(status)) {
+            std::cerr << "Error: " << std::get<1>(status) << std::endl;
+            return 1;
+        }
     } else {
-        App app;
+        App app(options.job.tuning, options.tuningString);
+        app.setCPUBudget(options.cpuBudget / 100);
+        app.setStemCacheDirectory(options.stemCacheDirectory);
+        app.setRenderAhead(options.renderAheadBlocks);
         app.run();
     }
 
@@ -0,0 +1,369 @@
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "filters.hpp"
+#include "turbo.hpp"
+
+namespace turbo {
+
+static bool matchesFilter(const std::string& filterString, const std::string& filterName)
+{
+    return startsWith(filterString, filterName + "(") && endsWith(filterString, ")");
+}
+
+static std::vector<std::string> getFilterArguments(
+    const std::string& filterString,
+    const std::string& filterName
+)
+{
+    int offset = std::string(filterName).size() + 1;
+    auto arguments = filterString.substr(offset, filterString.size() - 1 - offset);
+    std::vector<std::string> trimmedArguments;
+    for (auto argument : split(arguments, ',')) {
+        trimmedArguments.push_back(trim(argument));
+    }
+    return trimmedArguments;
+}
+
+static io::Status parseFloatArgument(const std::string& argument, float& result)
+{
+    try {
+        result = std::stof(argument);
+        return std::make_tuple(true, "");
+    } catch (const std::invalid_argument& e) {
+        return std::make_tuple(false, "Invalid float: '" + argument + "'");
+    } catch (const std::out_of_range& e) {
+        return std::make_tuple(false, "Invalid float: '" + argument + "'");
+    }
+}
+
+// Parses each argument into the float it goes with, stopping at the first
+// that isn't one.
+static io::Status parseFloatArguments(
+    const std::vector<std::string>& arguments,
+    std::vector<int> indices,
+    std::vector<float*> results
+)
+{
+    for (int i = 0; i < static_cast<int>(indices.size()); i++) {
+        auto status = parseFloatArgument(arguments[indices[i]], *results[i]);
+        if (!std::get<0>(status)) {
+            return status;
+        }
+    }
+    return std::make_tuple(true, "");
+}
+
+static bool parseBoolArgument(const std::string& argument)
+{
+    return argument == "true";
+}
+
+static io::Status parseLilypondNoteName(const std::string& noteName, int& pitch)
+{
+    std::vector<char> baseNames = { 'c', 'd', 'e', 'f', 'g', 'a', 'b' };
+    std::vector<int> basePitches = { 0, 2, 4, 5, 7, 9, 11 };
+    io::Status invalid = std::make_tuple(false, "Invalid note name: '" + noteName + "'");
+    if (noteName.size() == 0 || noteName.size() > 2) {
+        return invalid;
+    }
+    char baseName = noteName[0];
+    bool baseNameFound = false;
+    for (int i = 0; i < static_cast<int>(baseNames.size()); i++) {
+        if (baseName == baseNames[i]) {
+            pitch = basePitches[i];
+            baseNameFound = true;
+            break;
+        }
+    }
+    if (!baseNameFound) {
+        return invalid;
+    }
+    if (noteName.size() == 2) {
+        char inflection = noteName[1];
+        if (inflection == 's') {
+            pitch += 1;
+        } else if (inflection == 'f') {
+            pitch -= 1;
+        } else {
+            return invalid;
+        }
+    }
+    pitch = pitch % 12;
+    return std::make_tuple(true, "");
+}
+
+static int getIndexOf(const std::vector<std::string>& vector, const std::string& string)
+{
+    for (int i = 0; i < static_cast<int>(vector.size()); i++) {
+        if (string == vector[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+io::Status applyFilterString(
+    Image image,
+    const Tuning& tuning,
+    const std::string& filterString,
+    std::mt19937& randomEngine
+)
+{
+    if (matchesFilter(filterString, "invert")) {
+        filters::applyInvert(image);
+    } else if (matchesFilter(filterString, "reverb")) {
+        auto arguments = getFilterArguments(filterString, "reverb");
+        if (arguments.size() != 3) {
+            return std::make_tuple(false, "Expected 3 arguments to reverb filter");
+        }
+        float reverbDecay;
+        float reverbDamping;
+        auto status = parseFloatArguments(
+            arguments, { 0, 1 }, { &reverbDecay, &reverbDamping }
+        );
+        if (!std::get<0>(status)) {
+            return status;
+        }
+        bool reverbReverse = parseBoolArgument(arguments[2]);
+        filters::applyReverb(image, reverbDecay, reverbDamping, reverbReverse);
+    } else if (matchesFilter(filterString, "scale_filter")) {
+        auto arguments = getFilterArguments(filterString, "scale_filter");
+        if (arguments.size() != 2) {
+            return std::make_tuple(false, "Expected 2 arguments to scale filter");
+        }
+        int root;
+        auto status = parseLilypondNoteName(arguments[0], root);
+        if (!std::get<0>(status)) {
+            return status;
+        }
+        auto scaleClassString = arguments[1];
+        std::vector<std::string> scaleClassNames = {
+            "major",
+            "minor",
+            "acoustic",
+            "harmonic_major",
+            "harmonic_mainor",
+            "whole_tone",
+            "octatonic",
+            "hexatonic"
+        };
+        int scaleClass = getIndexOf(scaleClassNames, scaleClassString);
+        if (scaleClass == -1) {
+            return std::make_tuple(false, "Invalid scale class: '" + scaleClassString + "'");
+        }
+        filters::applyScaleFilter(image, tuning, root, scaleClass);
+    } else if (matchesFilter(filterString, "chorus")) {
+        auto arguments = getFilterArguments(filterString, "chorus");
+        if (arguments.size() != 2) {
+            return std::make_tuple(false, "Expected 2 arguments to chorus filter");
+        }
+        float chorusRate;
+        float chorusDepth;
+        auto status = parseFloatArguments(
+            arguments, { 0, 1 }, { &chorusRate, &chorusDepth }
+        );
+        if (!std::get<0>(status)) {
+            return status;
+        }
+        filters::applyChorus(image, randomEngine, chorusRate, chorusDepth);
+    } else if (matchesFilter(filterString, "tremolo")) {
+        auto arguments = getFilterArguments(filterString, "tremolo");
+        if (arguments.size() != 4) {
+            return std::make_tuple(false, "Expected 4 arguments to tremolo filter");
+        }
+        float tremoloRate;
+        float tremoloDepth;
+        float tremoloStereo;
+        auto status = parseFloatArguments(
+            arguments, { 0, 1, 3 }, { &tremoloRate, &tremoloDepth, &tremoloStereo }
+        );
+        if (!std::get<0>(status)) {
+            return status;
+        }
+        std::string tremoloShapeString = arguments[2];
+        std::vector<std::string> tremoloShapeNames = {
+            "sine", "triangle", "square", "saw_down", "saw_up"
+        };
+        int tremoloShape = getIndexOf(tremoloShapeNames, tremoloShapeString);
+        if (tremoloShape == -1) {
+            return std::make_tuple(false, "Invalid tremolo shape: '" + tremoloShapeString + "'");
+        }
+        filters::applyTremolo(
+            image, tremoloRate, tremoloDepth, tremoloShape, tremoloStereo
+        );
+    } else if (matchesFilter(filterString, "harmonics")) {
+        auto arguments = getFilterArguments(filterString, "harmonics");
+        if (arguments.size() != 5) {
+            return std::make_tuple(false, "Expected 5 arguments to harmonics filter");
+        }
+        float harmonics2;
+        float harmonics3;
+        float harmonics4;
+        float harmonics5;
+        auto status = parseFloatArguments(
+            arguments,
+            { 0, 1, 2, 3 },
+            { &harmonics2, &harmonics3, &harmonics4, &harmonics5 }
+        );
+        if (!std::get<0>(status)) {
+            return status;
+        }
+        float harmonicsSubharmonics = parseBoolArgument(arguments[4]);
+        filters::applyHarmonics(
+            image, tuning, harmonics2, harmonics3, harmonics4, harmonics5, harmonicsSubharmonics
+        );
+    } else {
+        return std::make_tuple(false, "Syntax error in filter string '" + filterString + "'");
+    }
+    return std::make_tuple(true, "");
+}
+
+static FileType getFileType(const std::string& fileName, FileType fileType)
+{
+    if (fileType != FileType::Default || fileName == "-") {
+        return fileType;
+    }
+    if (endsWith(fileName, ".wav")) {
+        return FileType::WAV;
+    }
+    if (endsWith(fileName, ".flac")) {
+        return FileType::FLAC;
+    }
+    return FileType::PNG;
+}
+
+static io::AudioFileType getAudioFileType(FileType fileType)
+{
+    switch (fileType) {
+    case FileType::WAV:
+        return io::AudioFileType::WAV;
+    case FileType::FLAC:
+        return io::AudioFileType::FLAC;
+    case FileType::Raw:
+        return io::AudioFileType::Raw;
+    default:
+        return io::AudioFileType::Default;
+    }
+}
+
+io::Status run(const Job& job, Workspace& workspace)
+{
+    std::mt19937 randomEngine(job.seed);
+
+    if (job.inFile == "") {
+        return std::make_tuple(false, "Input file -i is required in turbo mode");
+    }
+    if (job.outFile == "") {
+        return std::make_tuple(false, "Output file -o is required in turbo mode");
+    }
+
+    FileType inFileType = getFileType(job.inFile, job.inFileType);
+    FileType outFileType = getFileType(job.outFile, job.outFileType);
+    if (inFileType == FileType::Default) {
+        return std::make_tuple(false, "Standard input needs a file type");
+    }
+    if (outFileType == FileType::Default) {
+        return std::make_tuple(false, "Standard output needs a file type");
+    }
+    bool inFileIsImage = inFileType == FileType::PNG;
+    bool outFileIsImage = outFileType == FileType::PNG;
+
+    int imageHeight = job.tuning.size();
+    workspace.pixels.resize(k_imageWidth * imageHeight);
+    Image image = std::make_tuple(workspace.pixels.data(), k_imageWidth, imageHeight);
+
+    io::Status status;
+    if (inFileIsImage) {
+        status = io::loadImage(image, job.inFile);
+    } else {
+        if (!workspace.audioLoader || workspace.audioLoader->getNumThreads() != job.numThreads) {
+            workspace.audioLoader = std::make_unique<io::AudioLoader>(job.numThreads);
+        }
+        status = workspace.audioLoader->load(
+            image, job.tuning, job.inFile, getAudioFileType(inFileType), job.sampleRate
+        );
+    }
+    if (!std::get<0>(status)) {
+        return status;
+    }
+
+    for (auto& filterString : job.filterStrings) {
+        status = applyFilterString(image, job.tuning, filterString, randomEngine);
+        if (!std::get<0>(status)) {
+            return status;
+        }
+    }
+
+    if (outFileIsImage) {
+        return io::saveImage(image, job.outFile);
+    }
+    io::RenderSettings settings;
+    settings.sampleRate = job.sampleRate;
+    settings.overallGain = job.overallGain;
+    settings.speedInPixelsPerSecond = job.speedInPixelsPerSecond;
+    settings.pdMode = job.pdMode;
+    settings.pdDistort = job.pdDistort;
+    settings.phaseMode = job.phaseMode;
+    settings.engine = job.engine;
+    settings.stemCacheDirectory = job.stemCacheDirectory;
+    if (job.draft) {
+        settings.quality = io::getDraftQuality();
+    }
+    settings.numThreads = job.numThreads;
+    settings.fileType = getAudioFileType(outFileType);
+    settings.sampleFormat = job.sampleFormat;
+    return io::renderAudio(image, job.tuning, job.outFile, randomEngine, settings);
+}
+
+// Each thread takes the next job nobody has started until there are none left,
+// so long jobs don't hold up short ones queued behind them.
+struct BatchContext {
+    const std::vector<Job>* jobs;
+    std::vector<io::Status>* statuses;
+    std::vector<std::unique_ptr<Workspace>>* workspaces;
+    std::atomic<int> nextJob;
+};
+
+static void runBatchThread(BatchContext* batch, int thread)
+{
+    Workspace& workspace = *(*batch->workspaces)[thread];
+    while (true) {
+        int job = batch->nextJob++;
+        if (job >= static_cast<int>(batch->jobs->size())) {
+            return;
+        }
+        (*batch->statuses)[job] = run((*batch->jobs)[job], workspace);
+    }
+}
+
+std::vector<io::Status> runBatch(const std::vector<Job>& jobs, int numThreads)
+{
+    numThreads = std::max(std::min<int>(numThreads, jobs.size()), 1);
+    std::vector<io::Status> statuses(jobs.size());
+    std::vector<std::unique_ptr<Workspace>> workspaces;
+    for (int i = 0; i < numThreads; i++) {
+        workspaces.push_back(std::make_unique<Workspace>());
+    }
+
+    BatchContext batch;
+    batch.jobs = &jobs;
+    batch.statuses = &statuses;
+    batch.workspaces = &workspaces;
+    batch.nextJob = 0;
+    // Plain threads rather than a WorkerPool, whose workers are pinned to
+    // cores and spin: jobs take seconds to minutes, and render and analyze
+    // on worker pools of their own.
+    std::vector<std::thread> threads;
+    for (int i = 1; i < numThreads; i++) {
+        threads.emplace_back(&runBatchThread, &batch, i);
+    }
+    runBatchThread(&batch, 0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return statuses;
+}
+
+} // namespace turbo
@@ -0,0 +1,75 @@
+#pragma once
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+#include "io.hpp"
+#include "Synth.hpp"
+#include "Tuning.hpp"
+
+namespace turbo {
+
+// The kind of a file a job reads or writes.
+enum class FileType {
+    // Told apart by the extension of the file name. Names with any other
+    // extension are images. Standard input and output, "-", have none.
+    Default,
+    // Any image stb_image reads on input.
+    PNG,
+    WAV,
+    FLAC,
+    // Interleaved stereo, floats on input. See io::AudioFileType.
+    Raw
+};
+
+// One conversion in turbo mode: a file in, filters applied in order, and a
+// file out. Either can be "-", standard input or output, given a type.
+struct Job {
+    std::string inFile;
+    std::string outFile;
+    FileType inFileType = FileType::Default;
+    FileType outFileType = FileType::Default;
+    std::vector<std::string> filterStrings;
+    Tuning tuning;
+    int seed = 0;
+
+    // Only for audio output, and raw audio input.
+    float sampleRate = 48000;
+    float overallGain = 0.1;
+    float speedInPixelsPerSecond = 100;
+    int pdMode = 0;
+    float pdDistort = 0;
+    PhaseMode phaseMode = PhaseMode::Float;
+    SynthEngine engine = SynthEngine::Oscillators;
+    std::string stemCacheDirectory;
+    bool draft = false;
+    int numThreads = 1;
+    io::SampleFormat sampleFormat = io::SampleFormat::Default;
+};
+
+// What a thread keeps from one job to the next, so that a batch of jobs
+// doesn't plan FFTs and allocate buffers for every one of them.
+struct Workspace {
+    std::vector<uint32_t> pixels;
+    // Made when the first job loads audio, and again when a job wants a
+    // different number of threads.
+    std::unique_ptr<io::AudioLoader> audioLoader;
+};
+
+// Parses a filter such as "reverb(0.3, 0.8, true)" and applies it.
+io::Status applyFilterString(
+    Image image,
+    const Tuning& tuning,
+    const std::string& filterString,
+    std::mt19937& randomEngine
+);
+
+io::Status run(const Job& job, Workspace& workspace);
+
+// Runs the jobs on up to numThreads threads at once. A failed job doesn't
+// stop the others. Returns each job's status, in order.
+std::vector<io::Status> runBatch(const std::vector<Job>& jobs, int numThreads);
+
+} // namespace turbo
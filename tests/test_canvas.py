@@ -1,3 +1,4 @@
+import os
 import pathlib
 import subprocess
 import tempfile
@@ -107,6 +108,44 @@ def test_mono_sound_to_image(canvas, mono_sound):
         np.testing.assert_allclose(out_image[:, :, 1], 0)
         np.testing.assert_allclose(out_image[:, :, 0], out_image[:, :, 2])
 
+def test_low_sound_to_image(canvas):
+    """A low sine lights up the bottom rows, where neighboring rows are less
+    than an FFT bin apart. Rows within the sine's bin all take it whole."""
+    with tempfile.TemporaryDirectory() as directory:
+        root = pathlib.Path(directory)
+        soundfile.write(root / "in.wav", sine_wave(48000, 1.0, 30), 48000)
+        subprocess.run([canvas, "-t", "-i", root / "in.wav", "-o", root / "out.png"], check=True)
+        out_image = np.asarray(PIL.Image.open(root / "out.png"))
+
+        assert np.all(out_image[:, :, 3] == 255)
+        assert np.any(out_image[-5:, :, 2] != 0)
+        column = out_image[:, 320, 2]
+        assert len(np.flatnonzero(column == column.max())) > 1
+
+def test_filterbank(canvas):
+    """Each row weighs the spectrum with a triangle that peaks at its
+    frequency and reaches zero at its neighbors'."""
+    with tempfile.TemporaryDirectory() as directory:
+        root = pathlib.Path(directory)
+        # Rows about 40 FFT bins apart. A sine on the 1000 Hz row in the left
+        # channel, and one halfway between 1000 and 1500 Hz in the right.
+        sound = np.hstack([sine_wave(48000, 1.0, 1000), sine_wave(48000, 1.0, 1250)])
+        soundfile.write(root / "in.wav", sound, 48000)
+        subprocess.run([
+            canvas, "-t", "-i", root / "in.wav", "-o", root / "out.png",
+            "--tuning", "hz:500,1000,1500,2000,2500"
+        ], check=True)
+        # Rows go from high to low, and the left channel is blue.
+        column = np.asarray(PIL.Image.open(root / "out.png"))[:, 320, :3].astype(int)
+        left = column[:, 2]
+        right = column[:, 0]
+
+        assert left[3] > 0
+        assert np.all(np.delete(left, 3) < 0.05 * left[3])
+        assert right[2] > 0
+        assert abs(right[3] - right[2]) <= 0.05 * right[2]
+        assert np.all(np.delete(right, [2, 3]) < 0.05 * right[2])
+
 def test_stereo_sound_to_image(canvas, stereo_sound):
     """Converting a stereo sound to image produces a non-blank image with the following
     properties:
@@ -146,7 +185,9 @@ def test_stereo_sound_to_sound(canvas, stereo_sound):
         assert np.any(out_sound[:, 0] != out_sound[:, 1])
 
 def test_image_to_sound_regression(canvas, gradient_image, write_regtests):
-    """Regression test for converting image to sound."""
+    """Regression test for converting image to sound. A change that alters the
+    default render's output has to regenerate the reference with
+    --write-regtests."""
 
     regression_test_file = REGRESSION_TEST_ROOT / "image_to_sound.wav"
 
@@ -163,3 +204,326 @@ def test_image_to_sound_regression(canvas, gradient_image, write_regtests):
 
     assert rate == expected_rate
     np.testing.assert_allclose(sound, expected_sound)
+
+def test_engines(canvas, gradient_image):
+    """--engine ifft and --engine auto sound like --engine oscillators on a
+    dense image."""
+    with tempfile.TemporaryDirectory() as directory:
+        root = pathlib.Path(directory)
+        # Start in silence, so the first column can be read ahead of time.
+        draw = PIL.ImageDraw.Draw(gradient_image)
+        draw.rectangle([(0, 0), (9, 99)], fill=(0, 0, 0))
+        gradient_image.save(root / "in.png")
+
+        def render(engine):
+            subprocess.run([
+                canvas, "-t", "-i", root / "in.png", "-o", root / "out.wav",
+                "--engine", engine
+            ], check=True)
+            sound, __ = soundfile.read(root / "out.wav")
+            return sound
+
+        expected_sound = render("oscillators")
+        for engine in ["ifft", "auto"]:
+            sound = render(engine)
+            assert sound.shape == expected_sound.shape
+            # The engines ramp amplitudes differently, so compare the error
+            # over the whole render rather than sample by sample.
+            error = np.sqrt(np.mean((sound - expected_sound) ** 2) / np.mean(expected_sound ** 2))
+            assert error < 0.05
+
+def test_onsets_line_up(canvas):
+    """Rows that start in the same column start sounding together, however
+    low they are, with either engine. Low partials are rendered in multirate
+    bands, which delay them more than high ones."""
+    with tempfile.TemporaryDirectory() as directory:
+        root = pathlib.Path(directory)
+
+        def onset(row, engine):
+            image = PIL.Image.new("RGB", (100, 100))
+            draw = PIL.ImageDraw.Draw(image)
+            draw.line([(50, row), (99, row)], fill=(255, 255, 255))
+            image.save(root / "in.png")
+            subprocess.run([
+                canvas, "-t", "-i", root / "in.png", "-o", root / "out.wav",
+                "--engine", engine
+            ], check=True)
+            sound, __ = soundfile.read(root / "out.wav")
+            loudness = np.abs(sound[:, 0])
+            return np.argmax(loudness > 0.1 * np.max(loudness))
+
+        onsets = [
+            onset(row, engine)
+            for row in [2, 50, 97]
+            for engine in ["oscillators", "ifft"]
+        ]
+        # Amplitudes are set once per 64-frame control block.
+        assert max(onsets) - min(onsets) <= 64
+
+def test_rows_and_tuning(canvas, flat_image):
+    """--rows and --tuning set the height of the canvas."""
+    with tempfile.TemporaryDirectory() as directory:
+        root = pathlib.Path(directory)
+        flat_image.save(root / "in.png")
+        subprocess.run([
+            canvas, "-t", "-i", root / "in.png", "-o", root / "out.png",
+            "--rows", "2000", "--tuning", "range:20:20000"
+        ], check=True)
+        assert PIL.Image.open(root / "out.png").size == (640, 2000)
+
+        subprocess.run([
+            canvas, "-t", "-i", root / "in.png", "-o", root / "out.png",
+            "--tuning", "hz:110,220,330,440"
+        ], check=True)
+        assert PIL.Image.open(root / "out.png").size == (640, 4)
+
+        subprocess.run([
+            canvas, "-t", "-i", root / "in.png", "-o", root / "out.wav",
+            "--rows", "100", "--tuning", "edo:12:55"
+        ], check=True)
+        out_sound, __ = soundfile.read(root / "out.wav")
+        assert np.any(out_sound != 0)
+
+def test_invalid_tuning(canvas, flat_image):
+    """An invalid tuning is an error."""
+    with tempfile.TemporaryDirectory() as directory:
+        root = pathlib.Path(directory)
+        flat_image.save(root / "in.png")
+        result = subprocess.run([
+            canvas, "-t", "-i", root / "in.png", "-o", root / "out.png",
+            "--tuning", "hz:440,220"
+        ])
+        assert result.returncode != 0
+
+def test_invalid_cpu_budget(canvas, flat_image):
+    """A CPU budget outside 0 to 100 percent is an error."""
+    with tempfile.TemporaryDirectory() as directory:
+        root = pathlib.Path(directory)
+        flat_image.save(root / "in.png")
+        result = subprocess.run([
+            canvas, "-t", "-i", root / "in.png", "-o", root / "out.png",
+            "--cpu-budget", "150"
+        ])
+        assert result.returncode != 0
+
+def test_stem_cache(canvas, gradient_image):
+    """Renders with a stem cache match renders without one, also after
+    editing the image."""
+    with tempfile.TemporaryDirectory() as directory:
+        root = pathlib.Path(directory)
+        cache = root / "stems"
+
+        def render(out_name, use_cache):
+            arguments = [
+                canvas, "-t", "-i", root / "in.png", "-o", root / out_name,
+                "--speed", "400"
+            ]
+            if use_cache:
+                arguments += ["--stem-cache", cache]
+            subprocess.run(arguments, check=True)
+            sound, __ = soundfile.read(root / out_name)
+            return sound
+
+        gradient_image.save(root / "in.png")
+        expected_sound = render("expected.wav", False)
+        np.testing.assert_allclose(render("cold.wav", True), expected_sound, atol=1e-5)
+        assert any(cache.iterdir())
+        np.testing.assert_allclose(render("warm.wav", True), expected_sound, atol=1e-5)
+
+        draw = PIL.ImageDraw.Draw(gradient_image)
+        draw.rectangle([(20, 40), (60, 45)], fill=(255, 0, 255))
+        gradient_image.save(root / "in.png")
+        expected_sound = render("expected.wav", False)
+        np.testing.assert_allclose(render("edited.wav", True), expected_sound, atol=1e-5)
+
+def test_draft(canvas, gradient_image):
+    """A draft render is at a quarter of the sample rate and as long as a
+    full render."""
+    with tempfile.TemporaryDirectory() as directory:
+        root = pathlib.Path(directory)
+        gradient_image.save(root / "in.png")
+        subprocess.run([
+            canvas, "-t", "-i", root / "in.png", "-o", root / "full.wav", "--speed", "400"
+        ], check=True)
+        subprocess.run([
+            canvas, "-t", "-i", root / "in.png", "-o", root / "draft.wav", "--speed", "400",
+            "--draft"
+        ], check=True)
+        full_sound, full_rate = soundfile.read(root / "full.wav")
+        draft_sound, draft_rate = soundfile.read(root / "draft.wav")
+        assert draft_rate * 4 == full_rate
+        assert abs(len(draft_sound) * 4 - len(full_sound)) <= 4
+        assert np.any(draft_sound != 0)
+
+def test_threads(canvas, gradient_image):
+    """Rendering on several threads gives the same sound as on one, also when
+    the render is streamed to the file in several pieces, both with phase
+    distortion and with pure sines rendered in multirate bands."""
+    with tempfile.TemporaryDirectory() as directory:
+        root = pathlib.Path(directory)
+        gradient_image.save(root / "in.png")
+
+        def render(file_name, threads, pd_distort):
+            subprocess.run([
+                canvas, "-t", "-i", root / "in.png", "-o", root / file_name,
+                "--speed", "20", "--pd-distort", pd_distort, "--threads", str(threads)
+            ], check=True)
+            sound, _ = soundfile.read(root / file_name)
+            return sound
+
+        for pd_distort in ["0", "0.3"]:
+            expected_sound = render("one.wav", 1, pd_distort)
+            assert len(expected_sound) == 640 // 20 * 48000
+            np.testing.assert_allclose(
+                render("threads.wav", 4, pd_distort), expected_sound, atol=1e-5
+            )
+
+def test_threads_sound_to_image(canvas, stereo_sound):
+    """Analyzing a sound on several threads gives the same image as on one."""
+    with tempfile.TemporaryDirectory() as directory:
+        root = pathlib.Path(directory)
+        soundfile.write(root / "in.wav", stereo_sound, 48000)
+
+        def load(file_name, threads):
+            subprocess.run([
+                canvas, "-t", "-i", root / "in.wav", "-o", root / file_name,
+                "--threads", str(threads)
+            ], check=True)
+            return np.asarray(PIL.Image.open(root / file_name))
+
+        np.testing.assert_array_equal(load("threads.png", 3), load("one.png", 1))
+
+def test_invalid_threads(canvas, flat_image):
+    """Rendering needs at least one thread."""
+    with tempfile.TemporaryDirectory() as directory:
+        root = pathlib.Path(directory)
+        flat_image.save(root / "in.png")
+        result = subprocess.run([
+            canvas, "-t", "-i", root / "in.png", "-o", root / "out.wav", "--threads", "0"
+        ])
+        assert result.returncode != 0
+
+def test_sample_formats(canvas, gradient_image):
+    """Integer formats and FLAC hold the same sound as floats, give or take
+    dither."""
+    with tempfile.TemporaryDirectory() as directory:
+        root = pathlib.Path(directory)
+        gradient_image.save(root / "in.png")
+
+        def render(file_name, *options):
+            subprocess.run([
+                canvas, "-t", "-i", root / "in.png", "-o", root / file_name, *options
+            ], check=True)
+            return soundfile.info(root / file_name).subtype, soundfile.read(root / file_name)[0]
+
+        _, float_sound = render("float.wav")
+        unclipped = np.abs(float_sound) < 0.99
+        for file_name, options, subtype, bits in [
+            ("pcm16.wav", ["--sample-format", "pcm16"], "PCM_16", 16),
+            ("pcm24.flac", [], "PCM_24", 24),
+        ]:
+            sound_subtype, sound = render(file_name, *options)
+            assert sound_subtype == subtype
+            # Triangular dither adds up to one step, and rounding half of one.
+            np.testing.assert_allclose(
+                sound[unclipped], float_sound[unclipped], atol=1.5 / 2 ** (bits - 1)
+            )
+
+        result = subprocess.run([
+            canvas, "-t", "-i", root / "in.png", "-o", root / "float.flac",
+            "--sample-format", "float"
+        ])
+        assert result.returncode != 0
+
+def test_pipes(canvas, gradient_image, stereo_sound):
+    """Turbo mode reads from standard input and writes to standard output,
+    given file types, the same as it does files."""
+    with tempfile.TemporaryDirectory() as directory:
+        root = pathlib.Path(directory)
+        gradient_image.save(root / "in.png")
+        subprocess.run([canvas, "-t", "-i", root / "in.png", "-o", root / "out.wav"], check=True)
+        file_sound, _ = soundfile.read(root / "out.wav")
+
+        result = subprocess.run(
+            [canvas, "-t", "-i", "-", "--in-format", "png", "-o", "-", "--out-format", "wav"],
+            input=(root / "in.png").read_bytes(),
+            stdout=subprocess.PIPE,
+            check=True
+        )
+        (root / "piped.wav").write_bytes(result.stdout)
+        piped_sound, _ = soundfile.read(root / "piped.wav")
+        np.testing.assert_array_equal(piped_sound, file_sound)
+
+        result = subprocess.run(
+            [canvas, "-t", "-i", "-", "--in-format", "raw", "-o", "-", "--out-format", "png"],
+            input=stereo_sound.astype("<f4").tobytes(),
+            stdout=subprocess.PIPE,
+            check=True
+        )
+        (root / "piped.png").write_bytes(result.stdout)
+        assert np.any(np.array(PIL.Image.open(root / "piped.png")) != 0)
+
+        result = subprocess.run([canvas, "-t", "-i", root / "in.png", "-o", "-"])
+        assert result.returncode != 0
+
+def test_long_sound_to_image(canvas):
+    """A sound file more than an FFT per column long, of which only the
+    analyzed windows are read, gives the same image as the whole sound read
+    from standard input."""
+    sample_rate = 48000
+    # 640 columns of 4096-sample FFTs, and a second more.
+    duration = (640 * 4096 + sample_rate) / sample_rate
+    t = np.arange(int(sample_rate * duration)) / sample_rate
+    # A chirp, so every column differs.
+    phase = 2 * np.pi * (100 * t + 2450 * t ** 2 / duration)
+    sound = np.stack([np.sin(phase), np.sin(1.01 * phase)], axis=1).astype("<f4")
+    with tempfile.TemporaryDirectory() as directory:
+        root = pathlib.Path(directory)
+        soundfile.write(root / "in.wav", sound, sample_rate, subtype="FLOAT")
+        subprocess.run([canvas, "-t", "-i", root / "in.wav", "-o", root / "file.png"], check=True)
+
+        subprocess.run(
+            [canvas, "-t", "-i", "-", "--in-format", "raw", "-o", root / "piped.png"],
+            input=sound.tobytes(),
+            check=True
+        )
+        file_image = np.array(PIL.Image.open(root / "file.png"))
+        assert np.any(file_image != 0)
+        np.testing.assert_array_equal(np.array(PIL.Image.open(root / "piped.png")), file_image)
+
+def test_prewarm_fft(canvas):
+    """Prewarming saves FFTW wisdom to the user's cache directory."""
+    with tempfile.TemporaryDirectory() as directory:
+        root = pathlib.Path(directory)
+        environment = dict(os.environ, HOME=str(root), XDG_CACHE_HOME=str(root / "cache"))
+        subprocess.run([canvas, "--prewarm-fft", "1024,4096"], env=environment, check=True)
+        assert any(root.glob("**/canvas/fftw_wisdom"))
+
+        result = subprocess.run([canvas, "--prewarm-fft", "1024,x"], env=environment)
+        assert result.returncode != 0
+
+def test_batch(canvas, flat_image, mono_sound):
+    """A batch runs every job in the manifest, and a failed job doesn't stop
+    the others, nor does a line asking for help."""
+    with tempfile.TemporaryDirectory() as directory:
+        root = pathlib.Path(directory)
+        flat_image.save(root / "in.png")
+        soundfile.write(root / "in.wav", mono_sound, 48000)
+        (root / "jobs.txt").write_text(
+            "# Jobs\n"
+            f"-i {root / 'in.png'} -o {root / 'out.wav'}\n"
+            "\n"
+            f"-i {root / 'in.wav'} -o {root / 'out.png'} -f \"reverb(0.5, 0.5, false)\"\n"
+            f"-i {root / 'in.png'} -o {root / 'bad.png'} -f \"reverb(x, 0.5, false)\"\n"
+            "--help\n"
+        )
+        result = subprocess.run(
+            [canvas, "--batch", root / "jobs.txt", "--threads", "2"],
+            stderr=subprocess.PIPE
+        )
+        assert result.returncode != 0
+        assert b"jobs.txt:5" in result.stderr
+        assert b"jobs.txt:6" in result.stderr
+        assert (root / "out.wav").exists()
+        assert (root / "out.png").exists()
+        assert not (root / "bad.png").exists()